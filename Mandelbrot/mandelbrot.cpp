@@ -1,17 +1,38 @@
 /**
  * This program paints the Mandelbrot set usign MPI and the escape time algorithm.
  *
- * The library png++ is used to save the mandelbrot final image to a file. Said library
- * is only a C++ wrapper for libpng.
+ * The final image is colored and encoded as PNG by the master with several threads:
+ * the scanlines are split in strips that are filtered and deflated in parallel with
+ * zlib, and then joined into a single zlib stream (see write_png). The library png++,
+ * a C++ wrapper for libpng, is only used to write the tiles of the Deep Zoom pyramid.
  *
  *
  * Antonio Coín Castro.
  */
 
 #include <iostream>
+#include <fstream>
+#include <vector>
 #include <complex>
 #include <cmath>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
 #include <mpi.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
 #include <png++/png.hpp>
 
 //************************************************************************************
@@ -19,22 +40,90 @@
 //------------------------------------------------------------------------------------
 
 //#define LINEAR_COLORING   // Coloring strategy
+//#define TILED_OUTPUT      // Render the full plane to an out-of-core tiled file
+//#define PYRAMID_OUTPUT    // Render the full plane to a Deep Zoom (DZI) tile pyramid
+//#define BUDDHABROT        // Render the density of escaping orbits (Buddhabrot)
+//#define RENDER_CACHE      // Reuse the columns computed by previous renders
+//#define ADAPTIVE_AA       // Supersample only the pixels on the edges of the image
+//#define AUTO_LIMIT        // Choose the iteration limit of each frame from a probe pass
 
 const float
-  precision     = 0.001;    // Precision when sampling complex numbers
+  precision     = 0.001,    // Precision when sampling complex numbers
+  center_re     = 0.0,      // Centre of the rendered region of the complex plane
+  center_im     = 0.0,
+  view_radius   = 2.0,      // Half the width of the rendered region
+  view_aspect   = 1.0,      // Width / height of the rendered region
+  view_angle    = 0.0;      // Rotation of the region around its centre (radians)
+
+int
+  limit         = 1000;     // Max iterations for escape time algorithm
 
 const int
-  limit         = 1000,     // Max iterations for escape time algorithm
-  radius        = 2,        // Complex subset is {z : -radius < Re z, Im z < radius}
+  radius        = 2,        // Escape radius for escape time algorithm
   img_W         = 1024,     // Width of final image
-  img_H         = 1024;     // Height of final image
+  img_H         = 1024,     // Height of final image
+  tile_size     = 256;      // Side of each tile in TILED_OUTPUT and PYRAMID_OUTPUT modes
+
+// In the tiled modes the image has one pixel per sample of the plane, so its
+// size is set through 'precision' (e.g. 0.00004 gives a 100001x100001 image).
+// In BUDDHABROT mode, points are sampled at random in the whole escape region
+// (the square of half side 'radius', not only the viewport), and the points of
+// their orbits that fall in the viewport are accumulated directly into an
+// img_W x img_H histogram.
+const long
+  buddha_samples = 1l << 24;   // Total number of sampled points
+const int
+  buddha_threads = 0;          // Threads per slave (0: as many as hardware threads)
+
+// Rows are sent to each slave in chunks sized after its measured throughput, so
+// that faster slaves get larger ones. At the end of each pass, idle slaves repeat
+// the chunks that slower slaves are still computing, and the first result wins.
+const int
+  max_chunk     = 64;       // Max rows per chunk
+
+// Threads of the master for coloring and PNG encoding (0: as many as hardware threads)
+const int
+  encode_threads = 0;
+
+// In RENDER_CACHE mode, columns are stored on disk in strips, and a strip is
+// only computed again if the viewport, resolution or limit have changed.
+const int
+  cache_strip   = 64;              // Columns per cache entry
+const long
+  cache_max     = 1l << 30;        // Bytes kept in the cache before evicting entries
+
+// In AUTO_LIMIT mode, the master iterates a probe_size x probe_size grid of the
+// plane, doubling the limit from limit_min (and continuing only the probe points
+// that have not escaped yet) while more than a fraction probe_late of the probe
+// escapes in the last half of the iterations. The result replaces 'limit', and
+// the image is then rendered from scratch with it: only the probe is resumed.
+const int
+  probe_size    = 64,
+  limit_min     = 64,
+  limit_max     = 1 << 20;
+const float
+  probe_late    = 0.002;
+
+// In ADAPTIVE_AA mode, the plane is sampled once per pixel of the final image, and
+// then aa_grid x aa_grid jittered samples are averaged for every pixel whose color
+// differs from that of a neighbour by more than aa_threshold.
+const int
+  aa_grid       = 4;
+const float
+  aa_threshold  = 16;
+
+const char
+  tiles_file[]  = "mandelbrot.tiles",
+  pyramid_dir[] = "mandelbrot",    // Writes mandelbrot.dzi and mandelbrot_files/
+  cache_dir[]   = "cache";         // Directory of the RENDER_CACHE mode
 
 const int
   num_slaves    = 3,
   num_processes = num_slaves + 1,
   id_master     = 0,
   tag_send      = 0,
-  tag_end       = 1;
+  tag_end       = 1,
+  tag_refine    = 2;
 
 
 //*********************************************************************
@@ -44,32 +133,369 @@ const int
 // A complex number
 typedef std::complex<float> Complex;
 
-// A square in the complex plane, sampled from pixels
+// A rectangle in the complex plane, sampled from a W x H grid of pixels. It is
+// described by its centre, its half width and half height, and a rotation angle
+// around the centre. The complex offsets of every column and every row are
+// precomputed, so that pixel (i,j) is just column(i) + row(j).
 class SampledPlane {
   private:
+    Complex center;
     float x_limit;
     float y_limit;
-    float jump;
+    float angle;
+    double cos_a;                   // cos(angle) and sin(angle), which every
+    double sin_a;                   // conversion between pixels and plane needs
+    int W;
+    int H;
+    std::vector<Complex> columns;   // Centre plus rotated offset of each column
+    std::vector<Complex> rows;      // Rotated offset of each row
+
+    // Rotate a vector of the unrotated rectangle by 'angle'
+    Complex rotate(double u, double v) const {
+      return Complex(u * cos_a - v * sin_a, u * sin_a + v * cos_a);
+    }
 
   public:
-    SampledPlane(float x_limit, float y_limit, float jump)
-      : x_limit(x_limit), y_limit(y_limit), jump(jump) { };
+    SampledPlane(Complex center, float x_limit, float y_limit, float angle, int W, int H)
+      : center(center), x_limit(x_limit), y_limit(y_limit), angle(angle),
+        cos_a(std::cos(angle)), sin_a(std::sin(angle)), W(W), H(H), columns(W), rows(H) {
+      for (int i = 0; i < W; i++)
+        columns[i] = center + rotate(-x_limit + 2.0 * x_limit * i / (W - 1), 0);
+      for (int j = 0; j < H; j++)
+        rows[j] = rotate(0, -y_limit + 2.0 * y_limit * j / (H - 1));
+    };
 
     // Getters
-    float x_min() const { return -x_limit; }
-    float x_max() const { return x_limit; }
-    float y_min() const { return -y_limit; }
-    float y_max() const { return y_limit; }
-    float get_jump() const { return jump; }
+    Complex get_center() const { return center; }
+    float get_x_limit() const { return x_limit; }
+    float get_y_limit() const { return y_limit; }
+    float get_angle() const { return angle; }
+
+    int width() const { return W; }
+    int height() const { return H; }
+
+    const Complex & column(int i) const { return columns[i]; }
+    const Complex * row_table() const { return rows.data(); }
+
+    Complex pixelToComplex(int i, int j) const {
+      return columns[i] + rows[j];
+    }
+
+    // Same as above, for a point (x,y) anywhere between pixels
+    Complex pixelToComplex(float x, float y) const {
+      return center + rotate(-x_limit + 2.0 * x_limit * x / (W - 1),
+                             -y_limit + 2.0 * y_limit * y / (H - 1));
+    }
+
+    // Inverse of the above: position of a complex number in the grid of pixels
+    void complexToPixel(Complex z, float & x, float & y) const {
+      Complex d = z - center;
+      double u = d.real() * cos_a + d.imag() * sin_a;
+      double v = -d.real() * sin_a + d.imag() * cos_a;
+      x = (u + x_limit) * (W - 1) / (2 * x_limit);
+      y = (v + y_limit) * (H - 1) / (2 * y_limit);
+    }
+};
+
+// A partition of a W x H image in square tiles, numbered in row-major order.
+// Tiles on the right and bottom borders may be smaller than the rest.
+class TileGrid {
+  private:
+    int W;
+    int H;
+    int size;
+
+  public:
+    TileGrid(int W, int H, int size) : W(W), H(H), size(size) { };
+
+    int tiles_x() const { return (W + size - 1) / size; }
+    int tiles_y() const { return (H + size - 1) / size; }
+    int count() const { return tiles_x() * tiles_y(); }
+    int tile_size() const { return size; }
+    int width() const { return W; }
+    int height() const { return H; }
+
+    // First pixel (i0,j0) and dimensions (w,h) of a given tile
+    void bounds(int tile, int & i0, int & j0, int & w, int & h) const {
+      i0 = (tile % tiles_x()) * size;
+      j0 = (tile / tiles_x()) * size;
+      w = std::min(size, W - i0);
+      h = std::min(size, H - j0);
+    }
+};
+
+// On-disk layout of a tiled image: a header, an index with one entry per tile,
+// and then the tiles themselves, each one an independent zlib stream holding
+// h rows of w gray pixels. Tiles are appended in completion order, and an
+// index entry with offset 0 marks a tile that has not been rendered yet.
+struct TileHeader {
+  char     magic[4];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t tile_size;
+  uint32_t limit;
+  float    center_re, center_im;
+  float    x_limit, y_limit;
+  float    angle;
+};
+
+struct TileIndexEntry {
+  uint64_t offset;
+  uint32_t size;
+  uint32_t reserved;
+};
+
+// A tiled image file that is assembled incrementally. Opening an existing file
+// with the same parameters resumes it, keeping the tiles already written.
+class TileFile {
+  private:
+    std::fstream file;
+    int fd = -1;           // Descriptor of the same file, only used for fsync
+    TileHeader header;
+    std::vector<TileIndexEntry> index;
+    std::string error_message;
+
+    std::streamoff entry_offset(int tile) const {
+      return sizeof(TileHeader) + tile * (std::streamoff) sizeof(TileIndexEntry);
+    }
+
+    // Move what has been written so far to stable storage: flush() only hands
+    // the data to the OS, which may still lose it if the machine goes down
+    bool sync() {
+      file.flush();
+      return file && fsync(fd) == 0;
+    }
+
+    // Record why the file could not be used, and fail
+    bool fail(const std::string & message) {
+      error_message = message;
+      return false;
+    }
+
+    bool fail_errno(const char * name) {
+      return fail(std::string("cannot use '") + name + "': " + std::strerror(errno));
+    }
+
+  public:
+    TileFile() { }
+    TileFile(const TileFile &) = delete;
+    TileFile & operator=(const TileFile &) = delete;
+
+    ~TileFile() {
+      if (fd >= 0)
+        close(fd);
+    }
+
+    static TileHeader make_header(const SampledPlane & plane, const TileGrid & grid) {
+      TileHeader h;
+      std::memcpy(h.magic, "MTIL", 4);
+      h.version = 2;
+      h.width = plane.width();
+      h.height = plane.height();
+      h.tile_size = grid.tile_size();
+      h.limit = limit;
+      h.center_re = plane.get_center().real();
+      h.center_im = plane.get_center().imag();
+      h.x_limit = plane.get_x_limit();
+      h.y_limit = plane.get_y_limit();
+      h.angle = plane.get_angle();
+      return h;
+    }
+
+    // Open or create the file. Returns false, with the reason in error(), if
+    // it cannot be read or written, or if an existing file was rendered with
+    // different parameters, so that it is never overwritten by mistake.
+    bool open(const char * name, const TileHeader & expected, int num_tiles) {
+      header = expected;
+      index.assign(num_tiles, TileIndexEntry());
+
+      // The descriptor is opened first, so that errno tells why it failed
+      fd = ::open(name, O_RDWR);
+      bool exists = fd >= 0;
+      if (!exists && errno == ENOENT)
+        fd = ::open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+        return fail_errno(name);
+
+      file.open(name, std::ios::in | std::ios::out | std::ios::binary);
+      if (!file.is_open())
+        return fail_errno(name);
+
+      if (exists) {
+        TileHeader found;
+        file.read((char *) &found, sizeof(found));
+        if (file && std::memcmp(&found, &expected, sizeof(found)) != 0)
+          return fail(std::string("cannot resume '") + name +
+                      "', it was rendered with different parameters");
+        file.read((char *) index.data(), num_tiles * sizeof(TileIndexEntry));
+        if (!file)
+          return fail(std::string("cannot resume '") + name + "', it is not a complete tile file");
+        return true;
+      }
+
+      file.write((const char *) &header, sizeof(header));
+      file.write((const char *) index.data(), num_tiles * sizeof(TileIndexEntry));
+      return sync() || fail_errno(name);
+    }
+
+    const std::string & error() const { return error_message; }
+
+    bool done(int tile) const { return index[tile].offset != 0; }
+
+    // Append a compressed tile and sync it, and only then publish it in the
+    // index (synced too), so a render interrupted half-way, even by a crash of
+    // the machine, never leaves an entry pointing to missing data. Returns
+    // false on a write error.
+    bool write(int tile, const unsigned char * data, int size) {
+      file.seekp(0, std::ios::end);
+      index[tile].offset = file.tellp();
+      index[tile].size = size;
+      file.write((const char *) data, size);
+      if (!sync())
+        return false;
+      file.seekp(entry_offset(tile));
+      file.write((const char *) &index[tile], sizeof(TileIndexEntry));
+      return sync();
+    }
+};
+
+
+// Identifies the contents of a cached strip: everything that determines the
+// colors computed for it. It is also stored at the start of the cache file.
+struct CacheKey {
+  float    center_re, center_im;
+  float    x_limit, y_limit;
+  float    angle;
+  uint32_t width, height;
+  uint32_t limit;
+  uint32_t radius;
+  uint32_t precision;   // Size of the floating point type of Complex
+  uint32_t coloring;
+  uint32_t strip_size;
+  uint32_t strip;
+};
+
+// An on-disk cache of strips of computed columns, one file per strip named after
+// a hash of its key. Hits are read through mmap, and the least recently used
+// files (by modification time, refreshed on every hit) are evicted when the
+// cache grows beyond 'cache_max' bytes.
+class StripCache {
+  private:
+    CacheKey key;
+
+    std::string path(int strip) const {
+      CacheKey k = key;
+      k.strip = strip;
+
+      // 64-bit FNV-1a hash of the key
+      uint64_t hash = 14695981039346656037ull;
+      const unsigned char * bytes = (const unsigned char *) &k;
+      for (size_t b = 0; b < sizeof(k); b++)
+        hash = (hash ^ bytes[b]) * 1099511628211ull;
+
+      std::ostringstream name;
+      name << cache_dir << "/" << std::hex << hash << ".strip";
+      return name.str();
+    }
+
+  public:
+    StripCache(const SampledPlane & plane) {
+      std::memset(&key, 0, sizeof(key));
+      key.center_re = plane.get_center().real();
+      key.center_im = plane.get_center().imag();
+      key.x_limit = plane.get_x_limit();
+      key.y_limit = plane.get_y_limit();
+      key.angle = plane.get_angle();
+      key.width = plane.width();
+      key.height = plane.height();
+      key.limit = limit;
+      key.radius = radius;
+      key.precision = sizeof(Complex::value_type);
+#ifdef LINEAR_COLORING
+      key.coloring = 1;
+#endif
+      key.strip_size = cache_strip;
+      mkdir(cache_dir, 0755);
+    }
+
+    int count() const { return (key.width + cache_strip - 1) / cache_strip; }
+    int first(int strip) const { return strip * cache_strip; }
+    int last(int strip) const { return std::min<int>(first(strip + 1), key.width); }
+
+    // Copy a strip into img if it is in the cache
+    bool load(int strip, float ** img) const {
+      std::string name = path(strip);
+      size_t column = key.height * sizeof(float);
+      size_t size = sizeof(CacheKey) + (last(strip) - first(strip)) * column;
+      struct stat info;
+      bool hit = false;
+
+      int fd = ::open(name.c_str(), O_RDONLY);
+      if (fd < 0)
+        return false;
 
-    const int width() const { return (2 * x_limit / jump) + 1; }
-    const int height() const { return (2 * y_limit / jump) + 1; }
+      if (fstat(fd, &info) == 0 && (size_t) info.st_size == size) {
+        void * data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+          CacheKey k = key;
+          k.strip = strip;
+          hit = std::memcmp(data, &k, sizeof(k)) == 0;
+          const char * columns = (const char *) data + sizeof(CacheKey);
+          for (int i = first(strip); hit && i < last(strip); i++)
+            std::memcpy(img[i], columns + (i - first(strip)) * column, column);
+          munmap(data, size);
+        }
+      }
+      close(fd);
 
-    Complex pixelToComplex(int i, int j) {
-      int W = width();
-      int H = height();
-      return Complex(-x_limit + (2 * x_limit) / (W - 1) * i,
-                     -y_limit + (2 * y_limit) / (H - 1) * j);
+      if (hit)
+        utimensat(AT_FDCWD, name.c_str(), NULL, 0);
+      return hit;
+    }
+
+    // Write a strip to a temporary file, and rename it so that readers never
+    // see it half written
+    void store(int strip, float ** img) const {
+      std::string name = path(strip);
+      std::ofstream file(name + ".tmp", std::ios::binary);
+      CacheKey k = key;
+      k.strip = strip;
+
+      file.write((const char *) &k, sizeof(k));
+      for (int i = first(strip); i < last(strip); i++)
+        file.write((const char *) img[i], key.height * sizeof(float));
+      file.close();
+
+      if (file)
+        std::rename((name + ".tmp").c_str(), name.c_str());
+    }
+
+    // Delete the least recently used strips until the cache fits in 'cache_max'
+    static void evict() {
+      std::vector<std::pair<time_t, std::string> > files;
+      std::vector<off_t> sizes;
+      long total = 0;
+      struct stat info;
+
+      DIR * dir = opendir(cache_dir);
+      if (dir == NULL)
+        return;
+      for (struct dirent * entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        std::string name = std::string(cache_dir) + "/" + entry->d_name;
+        if (name.size() > 6 && name.compare(name.size() - 6, 6, ".strip") == 0 &&
+            stat(name.c_str(), &info) == 0) {
+          files.push_back(std::make_pair(info.st_mtime, name));
+          total += info.st_size;
+        }
+      }
+      closedir(dir);
+
+      std::sort(files.begin(), files.end());
+      for (size_t f = 0; f < files.size() && total > cache_max; f++) {
+        if (stat(files[f].second.c_str(), &info) == 0 && unlink(files[f].second.c_str()) == 0)
+          total -= info.st_size;
+      }
     }
 };
 
@@ -78,24 +504,146 @@ class SampledPlane {
 // Helper functions
 //---------------------------------------------------------------------------
 
-// Construct a PNG image and print it to a file (using png++)
-void visualize(SampledPlane plane, float ** img) {
-  png::image<png::rgb_pixel> img_png(img_W, img_H);
+// Run body(first, last) on encode_threads threads, splitting [0,n) in contiguous ranges
+void parallel_for(int n, std::function<void(int, int)> body) {
+  const int T = encode_threads > 0 ? encode_threads
+                                   : std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < T; t++)
+    threads.push_back(std::thread(body, (long) n * t / T, (long) n * (t + 1) / T));
+  for (int t = 0; t < T; t++)
+    threads[t].join();
+}
+
+// Append a PNG chunk to a file
+void write_chunk(std::ofstream & file, const char * type, const unsigned char * data, uint32_t size) {
+  unsigned char length[4] = { (unsigned char) (size >> 24), (unsigned char) (size >> 16),
+                              (unsigned char) (size >> 8), (unsigned char) size };
+  uLong crc = crc32(crc32(0, NULL, 0), (const Bytef *) type, 4);
+  if (size > 0)
+    crc = crc32(crc, data, size);
+  unsigned char crc_bytes[4] = { (unsigned char) (crc >> 24), (unsigned char) (crc >> 16),
+                                 (unsigned char) (crc >> 8), (unsigned char) crc };
+
+  file.write((const char *) length, 4);
+  file.write(type, 4);
+  file.write((const char *) data, size);
+  file.write((const char *) crc_bytes, 4);
+}
+
+// Write an 8-bit gray (channels = 1) or RGB (channels = 3) image as PNG. Scanlines
+// are split in one strip per thread, and every strip is filtered and deflated on
+// its own, as a raw deflate stream that ends on a byte boundary. Concatenated,
+// the strips form a single zlib stream, whose Adler-32 checksum is combined from
+// those of the strips. If zlib fails, an error is printed and no file is written.
+void write_png(const char * name, int W, int H, int channels, const unsigned char * pixels) {
+  const size_t line = 1 + (size_t) W * channels;   // Filter type byte and pixels
+  std::vector<std::vector<unsigned char> > strips;
+  std::vector<uLong> checksums;
+  std::vector<std::pair<int,int> > rows;   // Rows of each strip
+  std::mutex strips_mutex;
+  bool failed = false;
+
+  parallel_for(H, [&](int first, int last) {
+    std::vector<unsigned char> raw(line * (last - first)), packed;
+    z_stream stream;
+
+    // 'Up' filter: difference with the pixel above (the row above the first
+    // one counts as zero)
+    for (int j = first; j < last; j++) {
+      const unsigned char * row = pixels + (size_t) j * W * channels;
+      const unsigned char * above = j > 0 ? row - (size_t) W * channels : NULL;
+      unsigned char * filtered = &raw[(j - first) * line];
+      filtered[0] = 2;
+      for (size_t b = 0; b < line - 1; b++)
+        filtered[1 + b] = row[b] - (above ? above[b] : 0);
+    }
+
+    std::memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      std::lock_guard<std::mutex> lock(strips_mutex);
+      failed = true;
+      return;
+    }
+    packed.resize(deflateBound(&stream, raw.size()) + 16);
+    stream.next_in = raw.data();
+    stream.avail_in = raw.size();
+    stream.next_out = packed.data();
+    stream.avail_out = packed.size();
+    int result = deflate(&stream, last == H ? Z_FINISH : Z_SYNC_FLUSH);
+    packed.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    std::lock_guard<std::mutex> lock(strips_mutex);
+    if (result != (last == H ? Z_STREAM_END : Z_OK)) {
+      failed = true;
+      return;
+    }
+    rows.push_back(std::make_pair(first, last));
+    strips.push_back(std::vector<unsigned char>());
+    strips.back().swap(packed);
+    checksums.push_back(adler32(adler32(0, NULL, 0), raw.data(), raw.size()));
+  });
+
+  if (failed) {
+    std::cout << "error: cannot compress '" << name << "'" << std::endl;
+    return;
+  }
+
+  // Put strips in order, and build the zlib stream around them
+  std::vector<size_t> order(strips.size());
+  for (size_t k = 0; k < order.size(); k++)
+    order[k] = k;
+  std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return rows[a] < rows[b]; });
+
+  std::vector<unsigned char> data = { 0x78, 0x9c };
+  uLong checksum = adler32(0, NULL, 0);
+  for (size_t k = 0; k < order.size(); k++) {
+    int num_rows = rows[order[k]].second - rows[order[k]].first;
+    data.insert(data.end(), strips[order[k]].begin(), strips[order[k]].end());
+    checksum = adler32_combine(checksum, checksums[order[k]], line * num_rows);
+  }
+  for (int b = 3; b >= 0; b--)
+    data.push_back(checksum >> (8 * b));
+
+  unsigned char header[13] = { (unsigned char) (W >> 24), (unsigned char) (W >> 16),
+                               (unsigned char) (W >> 8), (unsigned char) W,
+                               (unsigned char) (H >> 24), (unsigned char) (H >> 16),
+                               (unsigned char) (H >> 8), (unsigned char) H,
+                               8, (unsigned char) (channels == 3 ? 2 : 0), 0, 0, 0 };
+  const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  const size_t max_chunk = 1 << 30;
+
+  std::ofstream file(name, std::ios::binary);
+  file.write((const char *) signature, 8);
+  write_chunk(file, "IHDR", header, 13);
+  for (size_t offset = 0; offset < data.size(); offset += max_chunk)
+    write_chunk(file, "IDAT", data.data() + offset, std::min(max_chunk, data.size() - offset));
+  write_chunk(file, "IEND", NULL, 0);
+}
+
+// Construct a PNG image and print it to a file, with several threads
+void visualize(const SampledPlane & plane, float ** img) {
+  std::vector<unsigned char> rgb(3 * img_W * img_H);
   int W = plane.width();
   int H = plane.height();
   float scale_W = (float) (W-1) / (img_W-1);
   float scale_H = (float) (H-1) / (img_H-1);
 
-  for (int i = 0; i < img_W; i++) {
-    for (int j = 0; j < img_H; j++) {
-      int x = i * scale_W;
-      int y = j * scale_H;
-      int color = img[x][y];
-      img_png[j][i] = png::rgb_pixel(color, color, color);
+  parallel_for(img_H, [&](int first, int last) {
+    for (int i = 0; i < img_W; i++) {
+      for (int j = first; j < last; j++) {
+        int x = i * scale_W;
+        int y = j * scale_H;
+        unsigned char color = (int) img[x][y];
+        rgb[3 * (j * img_W + i)] = rgb[3 * (j * img_W + i) + 1] = rgb[3 * (j * img_W + i) + 2] = color;
+      }
     }
-  }
+  });
 
-  img_png.write("mandelbrot.png");
+  write_png("mandelbrot.png", img_W, img_H, 3, rgb.data());
 }
 
 // Compute one iteration of the mandelbrot sequence
@@ -103,57 +651,337 @@ Complex function_mandelbrot(Complex z, Complex c) {
   return z * z + c;
 }
 
-// Apply the escape time algorithm to calculate the colors of a given row
-void calculate_colors(SampledPlane plane, float * img, int i) {
+// Continue the mandelbrot sequence of c from z (after n iterations) until it
+// escapes or n reaches max_iterations
+void iterate(Complex c, Complex & z, int & n, int max_iterations) {
+  while (std::abs(z) <= radius && n < max_iterations) {
+    z = function_mandelbrot(z, c);
+    n++;
+  }
+}
+
+// Apply the escape time algorithm to calculate the color of a complex number
+float escape_color(Complex c) {
   int n_iterations;
   const int RGB_MAX = 1 << 8;
+  Complex z(0);
 
-  for (int j = 0; j < plane.height(); j++) {
-    Complex z(0);
+  n_iterations = 0;
+  iterate(c, z, n_iterations, limit);
 
-    // Scale pixel (i,j) to a complex number in our plane
-    Complex c = plane.pixelToComplex(i,j);
+#ifdef LINEAR_COLORING
+  // Compute color of the pixel from 0 to 255 (linear map)
+  float scale = (float) (RGB_MAX-1) / (limit-1);
+  return (limit - n_iterations) * scale;
+#else
+  // A couple of extra iterations to improve the coloring algorithm
+  const int EXTRA_ITER = 3;
+  for (int k = 0; k < EXTRA_ITER; k++) {
+    z = function_mandelbrot(z,c);
+    n_iterations++;
+  }
 
-    n_iterations = 0;
-    while (std::abs(z) <= radius && n_iterations < limit) {
-      z = function_mandelbrot(z, c);
-      n_iterations++;
+  // Compute color of the pixel from 0 to 255 (continuous coloring)
+  if (n_iterations == limit + EXTRA_ITER)
+    return 0.0;
+  else
+    return (n_iterations - log(log(abs(z)))/log(radius)) / n_iterations * RGB_MAX-1;
+#endif
+}
+
+// Choose an iteration limit for the plane from a low resolution probe. Each time
+// the limit is doubled, only the probe points still undecided are iterated
+// further, continuing from their saved z. The pixels of the image are not kept
+// across limits: the slaves compute each one once, with the final limit, so
+// the probe is the only work done more than once
+int tune_limit(const SampledPlane & plane) {
+  std::vector<Complex> c, z;
+  std::vector<int> n;
+  int max_iterations = limit_min;
+
+  for (int i = 0; i < probe_size; i++) {
+    for (int j = 0; j < probe_size; j++) {
+      c.push_back(plane.pixelToComplex((float) i * (plane.width() - 1) / (probe_size - 1),
+                                       (float) j * (plane.height() - 1) / (probe_size - 1)));
+      z.push_back(0);
+      n.push_back(0);
     }
+  }
 
-#ifdef LINEAR_COLORING
-    // Compute color of the pixel from 0 to 255 (linear map)
-    float scale = (float) (RGB_MAX-1) / (limit-1);
-    img[j] = (limit - n_iterations) * scale;
-#else
-    // A couple of extra iterations to improve the coloring algorithm
-    const int EXTRA_ITER = 3;
-    for (int k = 0; k < EXTRA_ITER; k++) {
-      z = function_mandelbrot(z,c);
-      n_iterations++;
+  while (true) {
+    int late = 0;
+    size_t undecided = 0;
+
+    for (size_t p = 0; p < c.size(); p++) {
+      iterate(c[p], z[p], n[p], max_iterations);
+      if (n[p] < max_iterations) {
+        late += n[p] > max_iterations / 2;
+      }
+      else {
+        c[undecided] = c[p];
+        z[undecided] = z[p];
+        n[undecided] = n[p];
+        undecided++;
+      }
     }
+    c.resize(undecided);
+    z.resize(undecided);
+    n.resize(undecided);
 
-    // Compute color of the pixel from 0 to 255 (continuous coloring)
-    if (n_iterations == limit + EXTRA_ITER)
-      img[j] = 0.0;
-    else
-      img[j] = (n_iterations - log(log(abs(z)))/log(radius)) / n_iterations * RGB_MAX-1;
-#endif
+    // Points escaping late mean that more would escape with a higher limit
+    if (late <= probe_late * probe_size * probe_size || max_iterations >= limit_max)
+      return max_iterations;
+    max_iterations *= 2;
+  }
+}
+
+// Calculate the colors of a given row
+void calculate_colors(const SampledPlane & plane, float * img, int i) {
+  const Complex column = plane.column(i);
+  const Complex * rows = plane.row_table();
+
+  for (int j = 0; j < plane.height(); j++) {
+    // Scale pixel (i,j) to a complex number in our plane
+    img[j] = escape_color(column + rows[j]);
+  }
+}
+
+// Average jittered samples, on a grid of aa_grid x aa_grid cells, over the area of
+// pixels (i,js[k]) of a given row
+void supersample_colors(const SampledPlane & plane, float * img, int i,
+                        const int * js, int n) {
+  for (int k = 0; k < n; k++) {
+    std::minstd_rand generator(i * plane.height() + js[k] + 1);
+    std::uniform_real_distribution<float> jitter(0, 1);
+    float sum = 0;
+
+    for (int sx = 0; sx < aa_grid; sx++) {
+      for (int sy = 0; sy < aa_grid; sy++) {
+        float x = i - 0.5f + (sx + jitter(generator)) / aa_grid;
+        float y = js[k] - 0.5f + (sy + jitter(generator)) / aa_grid;
+        sum += escape_color(plane.pixelToComplex(x, y));
+      }
+    }
+
+    img[k] = sum / (aa_grid * aa_grid);
   }
 }
 
+// Pixels of a given row whose color differs from any of its neighbours' by
+// more than aa_threshold
+std::vector<int> edge_pixels(float ** img, int W, int H, int i) {
+  std::vector<int> js;
+
+  for (int j = 0; j < H; j++) {
+    bool edge = false;
+    for (int di = std::max(i - 1, 0); di <= std::min(i + 1, W - 1) && !edge; di++)
+      for (int dj = std::max(j - 1, 0); dj <= std::min(j + 1, H - 1) && !edge; dj++)
+        edge = std::abs(img[di][dj] - img[i][j]) > aa_threshold;
+    if (edge)
+      js.push_back(j);
+  }
+
+  return js;
+}
+
+// Calculate the gray levels of a tile, stored row by row. Returns its size in bytes
+int calculate_tile(const SampledPlane & plane, const TileGrid & grid, int tile, unsigned char * pixels) {
+  int i0, j0, w, h;
+  grid.bounds(tile, i0, j0, w, h);
+
+  const Complex * rows = plane.row_table();
+
+  for (int j = 0; j < h; j++) {
+    for (int i = 0; i < w; i++) {
+      float color = escape_color(plane.column(i0 + i) + rows[j0 + j]);
+      pixels[j * w + i] = std::min(std::max(color, 0.0f), 255.0f);
+    }
+  }
+
+  return w * h;
+}
+
 
 //***************************************************************************************
 // Master: send rows to slaves for processing, and ultimately print the resulting image
 //---------------------------------------------------------------------------------------
-void master(SampledPlane plane) {
-  int W = plane.width();
-  int H = plane.height();
-  int colored_rows = 0;
-  int tag;
+
+// What the master knows about the slaves, kept across passes
+struct SlaveState {
+  std::vector<double> rates;   // Throughput in samples per second (0 if unknown)
+  std::vector<bool> stale;     // Still computing a copy of a chunk of a past pass
+
+  SlaveState() : rates(num_processes, 0), stale(num_processes, false) { };
+};
+
+// Receive and discard the result of a chunk that is no longer needed
+void discard_result(int id_slave) {
+  std::vector<float> scratch;
+  MPI_Status status;
+  int row_id;
+  int n;
+
+  MPI_Recv(&row_id, 1, MPI_INT, id_slave, tag_send, MPI_COMM_WORLD, &status);
+  MPI_Probe(id_slave, tag_send, MPI_COMM_WORLD, &status);
+  MPI_Get_count(&status, MPI_FLOAT, &n);
+  scratch.resize(n);
+  MPI_Recv(scratch.data(), n, MPI_FLOAT, id_slave, tag_send, MPI_COMM_WORLD, &status);
+}
+
+// Hand out 'num_tasks' tasks to the slaves dynamically, and return once all are done.
+// Every slave gets chunks of consecutive tasks: a share of the remaining ones that
+// shrinks as they run out (so that the end of the pass stays balanced), scaled by
+// the throughput of the slave relative to the others, up to chunk_limit tasks.
+// 'work' gives the number of samples of a task, 'send' sends a chunk (first task,
+// number of tasks) to a slave, and 'receive' gets its result once the row_id that
+// precedes every result has arrived.
+// When no tasks are left, idle slaves repeat the chunk expected to finish last,
+// if they would finish it sooner, and whichever copy arrives first completes it.
+// Slaves still computing a copy when the pass ends are left as stale, and their
+// result is discarded when it arrives.
+void dispatch_rows(int num_tasks, int chunk_limit, SlaveState & slaves,
+                   std::function<double(int)> work,
+                   std::function<void(int, int, int)> send,
+                   std::function<void(int, int, int)> receive) {
+  struct Chunk {
+    int first;
+    int count;
+    double work;
+    int copies;
+    bool done;
+  };
+  std::vector<Chunk> chunks;
+  std::vector<int> assigned(num_processes, -1);    // Chunk of each slave (-1: none)
+  std::vector<double> started(num_processes);      // When it was sent
+  std::vector<double> & rates = slaves.rates;
+  int next = 0;
+  int done = 0;
   int id_slave;
   int row_id;
+  MPI_Status status;
+
+  // Expected time for a slave to compute some work
+  auto duration = [&](int id, double amount) { return amount / rates[id]; };
+
+  // Give an idle slave a new chunk, or a copy of a running one, if there is any
+  auto assign = [&](int id) {
+    int c = -1;
+
+    if (slaves.stale[id] || assigned[id] >= 0)
+      return;
+
+    if (next < num_tasks) {
+      double mean = 0;
+      int measured = 0;
+      for (int k = 1; k <= num_slaves; k++) {
+        mean += rates[k];
+        measured += rates[k] > 0;
+      }
+
+      // A slave whose throughput is still unknown gets a single task to measure it
+      int count = 1;
+      if (rates[id] > 0) {
+        int share = (num_tasks - next) / (2 * num_slaves) * rates[id] / (mean / measured);
+        count = std::min(std::max(share, 1), chunk_limit);
+      }
+      count = std::min(count, num_tasks - next);
+      Chunk chunk = { next, count, 0, 0, false };
+      for (int k = next; k < next + count; k++)
+        chunk.work += work(k);
+      next += count;
+      chunks.push_back(chunk);
+      c = chunks.size() - 1;
+    }
+    else if (rates[id] > 0) {
+      double now = MPI_Wtime(), latest = now;
+      for (int k = 1; k <= num_slaves; k++) {
+        int running = assigned[k];
+        if (running < 0 || chunks[running].done || chunks[running].copies > 1 || rates[k] <= 0)
+          continue;
+
+        // A chunk running late is assumed to need at least as long as it has taken so far
+        double finish = std::max(started[k] + duration(k, chunks[running].work),
+                                 2 * now - started[k]);
+        if (finish > latest && now + duration(id, chunks[running].work) < finish) {
+          latest = finish;
+          c = running;
+        }
+      }
+    }
+
+    if (c >= 0) {
+      chunks[c].copies++;
+      started[id] = MPI_Wtime();
+      assigned[id] = c;
+      send(chunks[c].first, chunks[c].count, id);
+    }
+  };
+
+  // Send initial rows
+  for (id_slave = 1; id_slave <= num_slaves; id_slave++)
+    assign(id_slave);
+
+  // Receive colored rows and send new ones dynamically
+  while (done < num_tasks) {
+    // While some slave is idle, keep checking whether it should repeat a late chunk
+    int arrived = 0;
+    while (!arrived) {
+      bool idle = false;
+      for (int k = 1; k <= num_slaves; k++) {
+        assign(k);
+        idle = idle || (assigned[k] < 0 && !slaves.stale[k]);
+      }
+
+      if (idle) {
+        MPI_Iprobe(MPI_ANY_SOURCE, tag_send, MPI_COMM_WORLD, &arrived, &status);
+        if (!arrived)
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      else {
+        MPI_Probe(MPI_ANY_SOURCE, tag_send, MPI_COMM_WORLD, &status);
+        arrived = 1;
+      }
+    }
+
+    id_slave = status.MPI_SOURCE;
+    if (slaves.stale[id_slave]) {
+      discard_result(id_slave);
+      slaves.stale[id_slave] = false;
+      continue;
+    }
+
+    MPI_Recv(&row_id, 1, MPI_INT, id_slave, tag_send, MPI_COMM_WORLD, &status);
+    Chunk & chunk = chunks[assigned[id_slave]];
+    receive(chunk.first, chunk.count, id_slave);
+    assigned[id_slave] = -1;
+
+    // Update the throughput of the slave, smoothing out variations between chunks
+    double elapsed = std::max(MPI_Wtime() - started[id_slave], 1e-6);
+    if (rates[id_slave] > 0)
+      rates[id_slave] = 0.5 * rates[id_slave] + 0.5 * chunk.work / elapsed;
+    else
+      rates[id_slave] = chunk.work / elapsed;
+
+    if (!chunk.done) {
+      chunk.done = true;
+      done += chunk.count;
+    }
+  }
+
+  // Slaves still running a copy of a chunk that is already done
+  for (int k = 1; k <= num_slaves; k++)
+    if (assigned[k] >= 0)
+      slaves.stale[k] = true;
+}
+
+void master(const SampledPlane & plane) {
+  int W = plane.width();
+  int H = plane.height();
   int i;
   float** img;
+  std::vector<int> pending;
+  std::vector<float> buffer;
+  SlaveState slaves;
   MPI_Status status;
 
   // Allocate memory for img
@@ -161,37 +989,89 @@ void master(SampledPlane plane) {
   for (i = 0; i < W; i++)
     img[i] = new float[H];
 
-  // Send initial rows
-  for (i = 0; i < num_slaves; i++) {
-    MPI_Send(&i, 1, MPI_INT, i+1, tag_send, MPI_COMM_WORLD);
-    MPI_Send(img[i], H, MPI_FLOAT, i+1, tag_send, MPI_COMM_WORLD);
+  // Decide which rows have to be computed
+#ifdef RENDER_CACHE
+  StripCache cache(plane);
+  std::vector<int> missing;
+  for (int s = 0; s < cache.count(); s++) {
+    if (!cache.load(s, img)) {
+      missing.push_back(s);
+      for (i = cache.first(s); i < cache.last(s); i++)
+        pending.push_back(i);
+    }
   }
+  std::cout << cache.count() - missing.size() << " of " << cache.count()
+            << " strips found in cache" << std::endl;
+#else
+  for (i = 0; i < W; i++)
+    pending.push_back(i);
+#endif
 
-  i--;
+  // Color the rows, one sample per pixel
+  dispatch_rows(pending.size(), max_chunk, slaves,
+    [&](int k) { return H; },
+    [&](int k, int n, int id_slave) {
+      MPI_Send(&pending[k], n, MPI_INT, id_slave, tag_send, MPI_COMM_WORLD);
+      MPI_Send(NULL, 0, MPI_FLOAT, id_slave, tag_send, MPI_COMM_WORLD);
+    },
+    [&](int k, int n, int id_slave) {
+      buffer.resize((size_t) n * H);
+      MPI_Recv(buffer.data(), n * H, MPI_FLOAT, id_slave, tag_send, MPI_COMM_WORLD, &status);
+      for (int r = 0; r < n; r++)
+        std::copy(&buffer[(size_t) r * H], &buffer[(size_t) r * H] + H, img[pending[k + r]]);
+    });
 
-  // Receive colored rows and send new ones dynamically
-  while (colored_rows < W) {
-    MPI_Recv(&row_id, 1, MPI_INT, MPI_ANY_SOURCE, tag_send, MPI_COMM_WORLD, &status);
-    id_slave = status.MPI_SOURCE;
-    MPI_Recv(img[row_id], H, MPI_FLOAT, id_slave, tag_send, MPI_COMM_WORLD, &status);
-    colored_rows++;
+#ifdef RENDER_CACHE
+  for (size_t s = 0; s < missing.size(); s++)
+    cache.store(missing[s], img);
+  StripCache::evict();
+#endif
 
-    // Decide whether to send more rows or to terminate slave
-    if (i < W - 1) {
-      tag = tag_send;
-      i++;
-    }
-    else {
-      tag = tag_end;
-    }
+#ifdef ADAPTIVE_AA
+  // Supersample the pixels on edges. They are all found before any of them
+  // changes, so that the result does not depend on the order of the rows
+  std::vector<int> rows;
+  std::vector<std::vector<int> > edges;
+  std::vector<float> values;
+  long refined = 0;
 
-    MPI_Send(&i, 1, MPI_INT, id_slave, tag_send, MPI_COMM_WORLD);
-    MPI_Send(img[i], H, MPI_FLOAT, id_slave, tag, MPI_COMM_WORLD);
+  for (i = 0; i < W; i++) {
+    std::vector<int> js = edge_pixels(img, W, H, i);
+    if (!js.empty()) {
+      rows.push_back(i);
+      edges.push_back(js);
+      refined += js.size();
+    }
   }
+  std::cout << refined << " of " << (long) W * H << " pixels supersampled" << std::endl;
+
+  // One row per chunk, as each one carries its own list of pixels
+  dispatch_rows(rows.size(), 1, slaves,
+    [&](int k) { return edges[k].size() * aa_grid * aa_grid; },
+    [&](int k, int n, int id_slave) {
+      MPI_Send(&rows[k], 1, MPI_INT, id_slave, tag_send, MPI_COMM_WORLD);
+      MPI_Send(edges[k].data(), edges[k].size(), MPI_INT, id_slave, tag_refine, MPI_COMM_WORLD);
+    },
+    [&](int k, int n, int id_slave) {
+      values.resize(edges[k].size());
+      MPI_Recv(values.data(), values.size(), MPI_FLOAT, id_slave, tag_send, MPI_COMM_WORLD, &status);
+      for (size_t e = 0; e < values.size(); e++)
+        img[rows[k]][edges[k][e]] = values[e];
+    });
+#endif
 
   // Print resulting image
   visualize(plane, img);
 
+  // Terminate slaves, once they have finished any chunk that is no longer needed
+  for (i = 1; i <= num_slaves; i++) {
+    if (slaves.stale[i])
+      discard_result(i);
+    MPI_Send(&i, 1, MPI_INT, i, tag_send, MPI_COMM_WORLD);
+    MPI_Send(NULL, 0, MPI_FLOAT, i, tag_end, MPI_COMM_WORLD);
+    std::cout << "Slave " << i << ": " << slaves.rates[i] / 1e6 << " Msamples/s" << std::endl;
+  }
+
   // Free memory
   for (i = 0; i < W; i++)
     delete[] img[i];
@@ -202,34 +1082,390 @@ void master(SampledPlane plane) {
 //************************************************************************************
 // Slave: receive rows, compute their colors, and send them back to master
 //------------------------------------------------------------------------------------
-void slave(SampledPlane plane, int id) {
-  float* row;
+void slave(const SampledPlane & plane, int id) {
+  std::vector<float> rows;
+  std::vector<int> row_ids;
+  std::vector<int> js;
   int H;
-  int row_id;
+  int n;
   MPI_Status status;
 
-  // Allocate memory for each row
   H = plane.height();
-  row = new float[H];
 
-  // Receive row_id and row
-  MPI_Recv(&row_id, 1, MPI_INT, id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-  MPI_Recv(row, H, MPI_FLOAT, id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+  // Receive row ids, and check which kind of work follows
+  MPI_Probe(id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+  MPI_Get_count(&status, MPI_INT, &n);
+  row_ids.resize(n);
+  MPI_Recv(row_ids.data(), n, MPI_INT, id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+  MPI_Probe(id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
 
   while (status.MPI_TAG != tag_end) {
-    calculate_colors(plane, row, row_id);
+    if (status.MPI_TAG == tag_refine) {
+      // Supersample some pixels of a row
+      MPI_Get_count(&status, MPI_INT, &n);
+      js.resize(n);
+      rows.resize(n);
+      MPI_Recv(js.data(), n, MPI_INT, id_master, tag_refine, MPI_COMM_WORLD, &status);
+      supersample_colors(plane, rows.data(), row_ids[0], js.data(), n);
+    }
+    else {
+      // Color whole rows
+      MPI_Recv(NULL, 0, MPI_FLOAT, id_master, tag_send, MPI_COMM_WORLD, &status);
+      n = row_ids.size() * H;
+      rows.resize(n);
+      for (size_t r = 0; r < row_ids.size(); r++)
+        calculate_colors(plane, &rows[r * H], row_ids[r]);
+    }
 
-    // Send row_id and colored row
-    MPI_Send(&row_id, 1, MPI_INT, id_master, tag_send, MPI_COMM_WORLD);
-    MPI_Send(row, H, MPI_FLOAT, id_master, tag_send, MPI_COMM_WORLD);
+    // Send row_id and colored rows
+    MPI_Send(&row_ids[0], 1, MPI_INT, id_master, tag_send, MPI_COMM_WORLD);
+    MPI_Send(rows.data(), n, MPI_FLOAT, id_master, tag_send, MPI_COMM_WORLD);
 
     // Receive more rows
-    MPI_Recv(&row_id, 1, MPI_INT, id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-    MPI_Recv(row, H, MPI_FLOAT, id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+    MPI_Probe(id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+    MPI_Get_count(&status, MPI_INT, &n);
+    row_ids.resize(n);
+    MPI_Recv(row_ids.data(), n, MPI_INT, id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+    MPI_Probe(id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
   }
 
-  // Free memory
-  delete[] row;
+  MPI_Recv(NULL, 0, MPI_FLOAT, id_master, tag_end, MPI_COMM_WORLD, &status);
+}
+
+
+//**************************************************************************************
+// Tiled modes: slaves render whole tiles, and the master hands each one to a
+// mode-specific function as it arrives
+//--------------------------------------------------------------------------------------
+typedef std::function<void(int, const std::vector<unsigned char> &)> TileHandler;
+
+// Send the given tiles to the slaves dynamically, and terminate them afterwards
+void dispatch_tiles(const std::vector<int> & pending, TileHandler store) {
+  std::vector<unsigned char> buffer;
+  size_t next = 0;
+  int busy = 0;
+  int tile_id = 0;
+  int size;
+  int id_slave;
+  MPI_Status status;
+
+  // Send initial tiles, and terminate slaves for which there is no work
+  for (int i = 1; i <= num_slaves; i++) {
+    if (next < pending.size()) {
+      MPI_Send(&pending[next++], 1, MPI_INT, i, tag_send, MPI_COMM_WORLD);
+      busy++;
+    }
+    else {
+      MPI_Send(&tile_id, 1, MPI_INT, i, tag_end, MPI_COMM_WORLD);
+    }
+  }
+
+  // Receive tiles and send new ones dynamically
+  while (busy > 0) {
+    MPI_Recv(&tile_id, 1, MPI_INT, MPI_ANY_SOURCE, tag_send, MPI_COMM_WORLD, &status);
+    id_slave = status.MPI_SOURCE;
+    MPI_Probe(id_slave, tag_send, MPI_COMM_WORLD, &status);
+    MPI_Get_count(&status, MPI_UNSIGNED_CHAR, &size);
+    buffer.resize(size);
+    MPI_Recv(buffer.data(), size, MPI_UNSIGNED_CHAR, id_slave, tag_send, MPI_COMM_WORLD, &status);
+    store(tile_id, buffer);
+
+    if (next < pending.size()) {
+      MPI_Send(&pending[next++], 1, MPI_INT, id_slave, tag_send, MPI_COMM_WORLD);
+    }
+    else {
+      MPI_Send(&tile_id, 1, MPI_INT, id_slave, tag_end, MPI_COMM_WORLD);
+      busy--;
+    }
+  }
+}
+
+// Tiled file: tiles are compressed by the slaves and appended to the file,
+// skipping those already present in it
+void master_tiles(const SampledPlane & plane) {
+  TileGrid grid(plane.width(), plane.height(), tile_size);
+  TileFile file;
+  std::vector<int> pending;
+
+  if (!file.open(tiles_file, TileFile::make_header(plane, grid), grid.count())) {
+    std::cout << "error: " << file.error() << std::endl;
+  }
+  else {
+    for (int t = 0; t < grid.count(); t++)
+      if (!file.done(t))
+        pending.push_back(t);
+
+    std::cout << grid.count() - pending.size() << " of " << grid.count()
+              << " tiles already rendered" << std::endl;
+  }
+
+  dispatch_tiles(pending, [&file](int tile, const std::vector<unsigned char> & data) {
+    if (!file.write(tile, data.data(), data.size()))
+      std::cout << "error: cannot write tile " << tile << " to '" << tiles_file << "'" << std::endl;
+  });
+}
+
+// Deep Zoom pyramid: full resolution tiles are rendered in Z-order, and every
+// coarser tile is built by downsampling its (up to four) children as soon as
+// they are all in memory, so the escape time algorithm runs only once per pixel
+class Pyramid {
+  private:
+    std::vector<TileGrid> levels;   // levels[0] is 1x1, levels.back() is full size
+    std::map<std::pair<int,int>, std::pair<std::vector<unsigned char>, int> > partial;
+
+    std::string tile_path(int level, int tile) const {
+      std::ostringstream path;
+      path << pyramid_dir << "_files/" << level << "/"
+           << tile % levels[level].tiles_x() << "_" << tile / levels[level].tiles_x() << ".png";
+      return path.str();
+    }
+
+    void write_png(int level, int tile, const unsigned char * pixels) const {
+      int i0, j0, w, h;
+      levels[level].bounds(tile, i0, j0, w, h);
+      png::image<png::gray_pixel> img_png(w, h);
+      for (int j = 0; j < h; j++)
+        for (int i = 0; i < w; i++)
+          img_png[j][i] = png::gray_pixel(pixels[j * w + i]);
+      img_png.write(tile_path(level, tile));
+    }
+
+    // Number of tiles of a level that fall into a given tile of the level above
+    int children(int level, int parent) const {
+      const TileGrid & child = levels[level + 1];
+      int px = parent % levels[level].tiles_x();
+      int py = parent / levels[level].tiles_x();
+      return (std::min(2 * px + 2, child.tiles_x()) - 2 * px) *
+             (std::min(2 * py + 2, child.tiles_y()) - 2 * py);
+    }
+
+  public:
+    Pyramid(int W, int H, int size) {
+      while (true) {
+        levels.insert(levels.begin(), TileGrid(W, H, size));
+        if (W == 1 && H == 1)
+          break;
+        W = (W + 1) / 2;
+        H = (H + 1) / 2;
+      }
+    }
+
+    const TileGrid & full() const { return levels.back(); }
+    int num_levels() const { return levels.size(); }
+
+    // Write the .dzi descriptor and one directory per level
+    void create_files() const {
+      std::ofstream dzi(std::string(pyramid_dir) + ".dzi");
+      dzi << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"png\" "
+          << "Overlap=\"0\" TileSize=\"" << full().tile_size() << "\">\n"
+          << "  <Size Width=\"" << full().width() << "\" Height=\"" << full().height() << "\"/>\n"
+          << "</Image>\n";
+
+      mkdir((std::string(pyramid_dir) + "_files").c_str(), 0755);
+      for (size_t l = 0; l < levels.size(); l++) {
+        std::ostringstream dir;
+        dir << pyramid_dir << "_files/" << l;
+        mkdir(dir.str().c_str(), 0755);
+      }
+    }
+
+    // Full resolution tiles in Z-order, so that sibling tiles finish close in time
+    std::vector<int> render_order() const {
+      std::vector<std::pair<uint64_t,int> > order;
+      for (int t = 0; t < full().count(); t++) {
+        uint64_t x = t % full().tiles_x(), y = t / full().tiles_x(), code = 0;
+        for (int b = 0; b < 32; b++)
+          code |= ((x >> b & 1) << (2 * b)) | ((y >> b & 1) << (2 * b + 1));
+        order.push_back(std::make_pair(code, t));
+      }
+      std::sort(order.begin(), order.end());
+
+      std::vector<int> tiles;
+      for (size_t k = 0; k < order.size(); k++)
+        tiles.push_back(order[k].second);
+      return tiles;
+    }
+
+    // Store a finished tile, and propagate it to the levels above
+    void add(int level, int tile, const unsigned char * pixels) {
+      write_png(level, tile, pixels);
+      if (level == 0)
+        return;
+
+      const TileGrid & grid = levels[level];
+      const TileGrid & up = levels[level - 1];
+      int tx = tile % grid.tiles_x(), ty = tile / grid.tiles_x();
+      int parent = (ty / 2) * up.tiles_x() + tx / 2;
+      int i0, j0, w, h, pi0, pj0, pw, ph;
+      grid.bounds(tile, i0, j0, w, h);
+      up.bounds(parent, pi0, pj0, pw, ph);
+
+      std::pair<std::vector<unsigned char>, int> & p = partial[std::make_pair(level - 1, parent)];
+      if (p.first.empty()) {
+        p.first.resize(pw * ph);
+        p.second = children(level - 1, parent);
+      }
+
+      // 2x2 box filter into the corresponding quadrant of the parent tile
+      for (int j = 0; j < (h + 1) / 2; j++) {
+        for (int i = 0; i < (w + 1) / 2; i++) {
+          int sum = 0, n = 0;
+          for (int dj = 2 * j; dj < std::min(2 * j + 2, h); dj++)
+            for (int di = 2 * i; di < std::min(2 * i + 2, w); di++, n++)
+              sum += pixels[dj * w + di];
+          p.first[(j0 / 2 - pj0 + j) * pw + (i0 / 2 - pi0 + i)] = (sum + n / 2) / n;
+        }
+      }
+
+      if (--p.second == 0) {
+        std::vector<unsigned char> done;
+        done.swap(p.first);
+        partial.erase(std::make_pair(level - 1, parent));
+        add(level - 1, parent, done.data());
+      }
+    }
+};
+
+void master_pyramid(const SampledPlane & plane) {
+  Pyramid pyramid(plane.width(), plane.height(), tile_size);
+  pyramid.create_files();
+
+  dispatch_tiles(pyramid.render_order(), [&pyramid](int tile, const std::vector<unsigned char> & data) {
+    pyramid.add(pyramid.num_levels() - 1, tile, data.data());
+  });
+}
+
+// Receive tiles, compute their gray levels, and send them back (compressed or not)
+void slave_tiles(const SampledPlane & plane, bool compress) {
+  TileGrid grid(plane.width(), plane.height(), tile_size);
+  std::vector<unsigned char> pixels(tile_size * tile_size);
+  std::vector<unsigned char> packed(compressBound(pixels.size()));
+  int tile_id;
+  int size;
+  uLongf packed_size;
+  MPI_Status status;
+
+  MPI_Recv(&tile_id, 1, MPI_INT, id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+
+  while (status.MPI_TAG != tag_end) {
+    size = calculate_tile(plane, grid, tile_id, pixels.data());
+
+    // Send tile_id and tile
+    MPI_Send(&tile_id, 1, MPI_INT, id_master, tag_send, MPI_COMM_WORLD);
+    if (compress) {
+      packed_size = packed.size();
+      compress2(packed.data(), &packed_size, pixels.data(), size, Z_DEFAULT_COMPRESSION);
+      MPI_Send(packed.data(), packed_size, MPI_UNSIGNED_CHAR, id_master, tag_send, MPI_COMM_WORLD);
+    }
+    else {
+      MPI_Send(pixels.data(), size, MPI_UNSIGNED_CHAR, id_master, tag_send, MPI_COMM_WORLD);
+    }
+
+    // Receive more tiles
+    MPI_Recv(&tile_id, 1, MPI_INT, id_master, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+  }
+}
+
+
+//**************************************************************************************
+// Buddhabrot: every slave traces the orbits of its share of random points with
+// several threads, each one accumulating into a private histogram. Histograms are
+// summed within each slave and then across slaves with MPI_Reduce
+//--------------------------------------------------------------------------------------
+
+// Points in the main cardioid or in the period-2 bulb never escape
+bool in_main_bulbs(Complex c) {
+  float x = c.real() - 0.25f, y2 = c.imag() * c.imag();
+  float q = x * x + y2;
+  return q * (q + x) <= 0.25f * y2 ||
+         (c.real() + 1) * (c.real() + 1) + y2 <= 0.0625f;
+}
+
+// Accumulate into 'hits' the pixels visited by the escaping orbits of 'samples'
+// points. The points are drawn from the whole escape region, whatever the
+// viewport: an orbit that starts outside the view may well pass through it.
+void trace_orbits(const SampledPlane & plane, long samples, std::seed_seq & seed, uint32_t * hits) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> coordinate(-radius, radius);
+  std::vector<Complex> orbit(limit);
+  float scale_W = (float) (img_W - 1) / (plane.width() - 1);
+  float scale_H = (float) (img_H - 1) / (plane.height() - 1);
+  float x, y;
+
+  for (long s = 0; s < samples; s++) {
+    float re = coordinate(generator);
+    Complex c(re, coordinate(generator));
+    if (in_main_bulbs(c))
+      continue;
+
+    Complex z(0);
+    int n_iterations = 0;
+    while (std::norm(z) <= radius * radius && n_iterations < limit) {
+      z = function_mandelbrot(z, c);
+      orbit[n_iterations++] = z;
+    }
+
+    if (n_iterations == limit)
+      continue;
+
+    for (int k = 0; k < n_iterations; k++) {
+      plane.complexToPixel(orbit[k], x, y);
+      int i = std::floor(x * scale_W + 0.5f);
+      int j = std::floor(y * scale_H + 0.5f);
+      if (i >= 0 && i < img_W && j >= 0 && j < img_H)
+        hits[j * img_W + i]++;
+    }
+  }
+}
+
+void master_buddhabrot(const SampledPlane & plane) {
+  const int size = img_W * img_H;
+  std::vector<uint32_t> zeros(size, 0), hits(size);
+  std::vector<unsigned char> gray(size);
+
+  MPI_Reduce(zeros.data(), hits.data(), size, MPI_UINT32_T, MPI_SUM, id_master, MPI_COMM_WORLD);
+
+  // Square root scaling, so that faint orbits remain visible
+  uint32_t max_hits = std::max(1u, *std::max_element(hits.begin(), hits.end()));
+  parallel_for(size, [&](int first, int last) {
+    for (int p = first; p < last; p++)
+      gray[p] = 255 * std::sqrt((float) hits[p] / max_hits);
+  });
+
+  write_png("buddhabrot.png", img_W, img_H, 1, gray.data());
+}
+
+void slave_buddhabrot(const SampledPlane & plane, int id) {
+  const int size = img_W * img_H;
+  const int T = buddha_threads > 0 ? buddha_threads
+                                   : std::max(1u, std::thread::hardware_concurrency());
+  const long samples = buddha_samples / num_slaves;
+  std::vector<std::vector<uint32_t> > hits(T, std::vector<uint32_t>(size, 0));
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < T; t++) {
+    threads.push_back(std::thread([&, t]() {
+      std::seed_seq seed = {id, t};
+      trace_orbits(plane, samples / T + (t < samples % T), seed, hits[t].data());
+    }));
+  }
+  for (int t = 0; t < T; t++)
+    threads[t].join();
+
+  // Sum the private histograms into the first one, each thread owning a slice
+  threads.clear();
+  for (int t = 0; t < T; t++) {
+    threads.push_back(std::thread([&, t]() {
+      for (int p = (long) size * t / T; p < (long) size * (t + 1) / T; p++)
+        for (int k = 1; k < T; k++)
+          hits[0][p] += hits[k][p];
+    }));
+  }
+  for (int t = 0; t < T; t++)
+    threads[t].join();
+
+  MPI_Reduce(hits[0].data(), NULL, size, MPI_UINT32_T, MPI_SUM, id_master, MPI_COMM_WORLD);
 }
 
 
@@ -238,17 +1474,49 @@ void slave(SampledPlane plane, int id) {
 //--------------------------------------------------------------------------------------
 int main(int argc, char** argv) {
   int id_self, current_num_processes;
-  SampledPlane plane(radius, radius, precision);
+#ifdef ADAPTIVE_AA
+  SampledPlane plane(Complex(center_re, center_im), view_radius, view_radius / view_aspect,
+                     view_angle, img_W, img_H);
+#else
+  SampledPlane plane(Complex(center_re, center_im), view_radius, view_radius / view_aspect,
+                     view_angle, (2 * view_radius / precision) + 1,
+                     (2 * view_radius / view_aspect / precision) + 1);
+#endif
 
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &id_self);
   MPI_Comm_size(MPI_COMM_WORLD, &current_num_processes);
 
   if (num_processes == current_num_processes) {
+#ifdef AUTO_LIMIT
+    if (id_self == id_master) {
+      limit = tune_limit(plane);
+      std::cout << "Iteration limit: " << limit << std::endl;
+    }
+    MPI_Bcast(&limit, 1, MPI_INT, id_master, MPI_COMM_WORLD);
+#endif
+
+#if defined(TILED_OUTPUT)
+    if (id_self == id_master)
+      master_tiles(plane);
+    else
+      slave_tiles(plane, true);
+#elif defined(PYRAMID_OUTPUT)
+    if (id_self == id_master)
+      master_pyramid(plane);
+    else
+      slave_tiles(plane, false);
+#elif defined(BUDDHABROT)
+    if (id_self == id_master)
+      master_buddhabrot(plane);
+    else
+      slave_buddhabrot(plane, id_self);
+#else
     if (id_self == id_master)
       master(plane);
     else
       slave(plane, id_self);
+#endif
   }
 
   else {
@@ -0,0 +1,191 @@
+/**
+ * Sistemas concurrentes y distribuidos.
+ * Práctica 1: semáforos (espacio de nombres SEM)
+ *
+ * Implementación propia, con la misma interfaz que la biblioteca de la
+ * asignatura (Semaphore, sem_wait, sem_signal), más try_wait y wait_for.
+ *
+ * El valor es un contador atómico: sem_wait lo decrementa con un
+ * compare_exchange si es positivo, y sem_signal lo incrementa, sin llamadas al
+ * sistema mientras no haya hebras dormidas. Si el valor es cero, sem_wait
+ * primero espera activamente unas vueltas (la mayoría de las esperas en un
+ * traspaso productor-consumidor son muy cortas) y solo después se duerme en un
+ * futex de Linux sobre el propio contador. El número de vueltas se adapta:
+ * crece cuando la espera activa suele acabar bien y decrece cuando no.
+ *
+ * Antonio Coín Castro.
+ */
+
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <ctime>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+namespace SEM
+{
+
+//**********************************************************************
+// espera y despertar en un futex (fuera de Linux, esperas cortas con yield)
+//----------------------------------------------------------------------
+
+// duerme mientras *dir valga $esperado$, como mucho $plazo$ (si no es nulo)
+inline void futex_esperar(std::atomic<int32_t> & dir, int32_t esperado,
+                          const timespec * plazo = nullptr)
+{
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<int32_t *>(&dir), FUTEX_WAIT_PRIVATE,
+          esperado, plazo, nullptr, 0);
+#else
+  (void) plazo;
+  if (dir.load() == esperado)
+    std::this_thread::yield();
+#endif
+}
+
+// despierta a una hebra dormida en *dir
+inline void futex_despertar(std::atomic<int32_t> & dir)
+{
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<int32_t *>(&dir), FUTEX_WAKE_PRIVATE, 1,
+          nullptr, nullptr, 0);
+#else
+  (void) dir;
+#endif
+}
+
+// pausa dentro de una espera activa (cede el núcleo hermano con hyperthreading)
+inline void pausa()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+//**********************************************************************
+// clase Semaphore
+//----------------------------------------------------------------------
+
+class Semaphore
+{
+public:
+  // permite 'Semaphore s = 0;' y 'Semaphore v[N] = {0, 0};'
+  Semaphore(unsigned valor_inicial) : valor(valor_inicial) { }
+
+  // solo para la inicialización anterior: no se debe mover un semáforo en uso
+  Semaphore(Semaphore && otro)
+    : valor(otro.valor.load()), vueltas(otro.vueltas.load()) { }
+
+  Semaphore(const Semaphore &) = delete;
+  Semaphore & operator=(const Semaphore &) = delete;
+
+  // decrementa si el valor es positivo; devuelve false (sin esperar) si no
+  bool try_wait()
+  {
+    int32_t v = valor.load(std::memory_order_relaxed);
+    while (v > 0)
+      if (valor.compare_exchange_weak(v, v - 1, std::memory_order_acquire,
+                                      std::memory_order_relaxed))
+        return true;
+    return false;
+  }
+
+  // espera a que el valor sea positivo y lo decrementa
+  void sem_wait()
+  {
+    if (try_wait() || esperar_activamente())
+      return;
+
+    dormidas.fetch_add(1, std::memory_order_seq_cst);
+    while (!try_wait())
+      futex_esperar(valor, 0);
+    dormidas.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // como sem_wait, pero se rinde pasado $plazo$; devuelve si ha decrementado
+  template< class Rep, class Period >
+  bool wait_for(const std::chrono::duration<Rep,Period> & plazo)
+  {
+    using namespace std::chrono;
+    const steady_clock::time_point limite = steady_clock::now() + plazo;
+
+    if (try_wait() || esperar_activamente())
+      return true;
+
+    dormidas.fetch_add(1, std::memory_order_seq_cst);
+    bool conseguido;
+    while (!(conseguido = try_wait()))
+    {
+      const nanoseconds resto = duration_cast<nanoseconds>(limite - steady_clock::now());
+      if (resto.count() <= 0)
+        break;
+      timespec ts;
+      ts.tv_sec  = resto.count() / 1000000000;
+      ts.tv_nsec = resto.count() % 1000000000;
+      futex_esperar(valor, 0, &ts);
+    }
+    dormidas.fetch_sub(1, std::memory_order_relaxed);
+    return conseguido;
+  }
+
+  // incrementa el valor y despierta a una hebra dormida, si la hay
+  void sem_signal()
+  {
+    valor.fetch_add(1, std::memory_order_seq_cst);
+    if (dormidas.load(std::memory_order_seq_cst) > 0)
+      futex_despertar(valor);
+  }
+
+private:
+  // espera activa adaptativa; devuelve true si ha podido decrementar
+  bool esperar_activamente()
+  {
+    const int32_t vueltas_min = 16, vueltas_max = 4096;
+    const int32_t limite = vueltas.load(std::memory_order_relaxed);
+
+    for (int32_t i = 0; i < limite; i++)
+    {
+      pausa();
+      if (valor.load(std::memory_order_relaxed) > 0 && try_wait())
+      {
+        // ha bastado: la próxima vez se permite esperar hasta el doble
+        ajustar_vueltas(std::min(vueltas_max, std::max(vueltas_min, 2*(i + 1))));
+        return true;
+      }
+    }
+    ajustar_vueltas(std::max(vueltas_min, limite / 2));   // no ha bastado
+    return false;
+  }
+
+  // media móvil del número de vueltas
+  void ajustar_vueltas(int32_t objetivo)
+  {
+    const int32_t v = vueltas.load(std::memory_order_relaxed);
+    vueltas.store(v + (objetivo - v) / 8, std::memory_order_relaxed);
+  }
+
+  std::atomic<int32_t> valor;              // unidades disponibles ($\geq 0$)
+  std::atomic<int32_t> dormidas{0};        // hebras dormidas en el futex
+  std::atomic<int32_t> vueltas{256};       // límite actual de espera activa
+};
+
+//**********************************************************************
+// funciones con la interfaz de la biblioteca original
+//----------------------------------------------------------------------
+
+inline void sem_wait(Semaphore & s)   { s.sem_wait(); }
+inline void sem_signal(Semaphore & s) { s.sem_signal(); }
+
+} // fin namespace SEM
+
+#endif
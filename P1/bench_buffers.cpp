@@ -0,0 +1,218 @@
+/**
+ * Sistemas concurrentes y distribuidos.
+ * Práctica 1: comparación de rendimiento de los buffers
+ *
+ * Mide cuántos items por segundo pasan de $p$ productores a $c$ consumidores
+ * (sin esperas ni salida por pantalla) con cinco buffers:
+ *   un_cerrojo:   el FIFO de prodcons-varios.cpp, un cerrojo y dos semáforos
+ *   dos_cerrojos: ColaDosCerrojos (buffers.h), un cerrojo por extremo
+ *   sin_cerrojos: ColaMPMC (buffers.h)
+ *   pila_cerrojo: el LIFO de prodcons-varios.cpp, un cerrojo y dos semáforos
+ *   pila_elimin:  PilaEliminacion (buffers.h)
+ * Los semáforos de las versiones con cerrojos son los de prodcons-varios.cpp
+ * (SEM::Semaphore, ver Semaphore.h), que no usan ningún cerrojo mientras no
+ * haya que dormir: así solo se comparan los cerrojos de los buffers. Se
+ * comprueba que la suma de los items consumidos es la de los producidos.
+ *
+ * Antonio Coín Castro.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "Semaphore.h"
+#include "buffers.h"
+
+using namespace std ;
+using namespace std::chrono ;
+using namespace SEM ;
+
+const unsigned tam_vec      = 16,         // tamaño del buffer
+               total_items  = 1000000,    // items por medida
+               repeticiones = 5;          // medidas por configuración (mediana)
+
+//**********************************************************************
+// buffers comparados, con la misma interfaz
+//----------------------------------------------------------------------
+
+class UnCerrojo
+{
+public:
+  void insertar(int dato)
+  {
+    sem_wait(libres);
+    mtx.lock();
+    vec[primera_libre] = dato;
+    primera_libre = (primera_libre+1) % tam_vec;
+    mtx.unlock();
+    sem_signal(ocupadas);
+  }
+
+  void extraer(int & dato)
+  {
+    sem_wait(ocupadas);
+    mtx.lock();
+    dato = vec[primera_ocupada];
+    primera_ocupada = (primera_ocupada+1) % tam_vec;
+    mtx.unlock();
+    sem_signal(libres);
+  }
+
+private:
+  Semaphore        ocupadas{0}, libres{tam_vec};
+  mutex            mtx;
+  int              vec[tam_vec];
+  unsigned         primera_libre = 0, primera_ocupada = 0;
+};
+
+class DosCerrojos
+{
+public:
+  void insertar(int dato)
+  {
+    sem_wait(libres);
+    cola.insertar(dato);
+    sem_signal(ocupadas);
+  }
+
+  void extraer(int & dato)
+  {
+    sem_wait(ocupadas);
+    cola.extraer(dato);
+    sem_signal(libres);
+  }
+
+private:
+  Semaphore                     ocupadas{0}, libres{tam_vec};
+  ColaDosCerrojos<int, tam_vec> cola;
+};
+
+class PilaCerrojo
+{
+public:
+  void insertar(int dato)
+  {
+    sem_wait(libres);
+    mtx.lock();
+    vec[primera_libre++] = dato;
+    mtx.unlock();
+    sem_signal(ocupadas);
+  }
+
+  void extraer(int & dato)
+  {
+    sem_wait(ocupadas);
+    mtx.lock();
+    dato = vec[--primera_libre];
+    mtx.unlock();
+    sem_signal(libres);
+  }
+
+private:
+  Semaphore        ocupadas{0}, libres{tam_vec};
+  mutex            mtx;
+  int              vec[tam_vec];
+  unsigned         primera_libre = 0;
+};
+
+class PilaElimin
+{
+public:
+  void insertar(int dato)   { pila.insertar(dato); }
+  void extraer(int & dato)  { pila.extraer(dato); }
+
+private:
+  PilaEliminacion<int, tam_vec> pila;
+};
+
+class SinCerrojos
+{
+public:
+  void insertar(int dato)   { cola.insertar(dato); }
+  void extraer(int & dato)  { cola.extraer(dato); }
+
+private:
+  ColaMPMC<int, tam_vec> cola;
+};
+
+//**********************************************************************
+// una medida: millones de items por segundo (o -1 si la suma no cuadra)
+//----------------------------------------------------------------------
+
+template< class Buffer >
+double medir(unsigned p, unsigned c)
+{
+  Buffer         buffer;
+  vector<thread> hebras;
+  vector<long>   sumas(c);
+
+  const time_point<steady_clock> inicio = steady_clock::now();
+
+  for (unsigned i = 0; i < p; i++)
+    hebras.push_back(thread([&, i]()
+    {
+      for (unsigned k = i*total_items/p; k < (i+1)*total_items/p; k++)
+        buffer.insertar(k);
+    }));
+  for (unsigned i = 0; i < c; i++)
+    hebras.push_back(thread([&, i]()
+    {
+      long suma = 0;
+      for (unsigned k = i*total_items/c; k < (i+1)*total_items/c; k++)
+      {
+        int dato;
+        buffer.extraer(dato);
+        suma += dato;
+      }
+      sumas[i] = suma;
+    }));
+  for (thread & hebra : hebras)
+    hebra.join();
+
+  const duration<double> tiempo = steady_clock::now() - inicio;
+
+  long total = 0;
+  for (long s : sumas)
+    total += s;
+  if (total != long(total_items) * (total_items - 1) / 2)
+    return -1.0;
+  return total_items / tiempo.count() / 1e6;
+}
+
+template< class Buffer >
+double mediana(unsigned p, unsigned c)
+{
+  vector<double> v;
+  for (unsigned r = 0; r < repeticiones; r++)
+    v.push_back(medir<Buffer>(p, c));
+  sort(v.begin(), v.end());
+  return v[v.size()/2];
+}
+
+//**********************************************************************
+// Programa principal
+//----------------------------------------------------------------------
+
+int main()
+{
+  const unsigned configuraciones[][2] = { {1, 1}, {2, 2}, {4, 4}, {4, 1}, {1, 4} };
+
+  cout << "Millones de items por segundo (mediana de " << repeticiones << " medidas)" << endl
+       << setw(12) << "prod x cons" << setw(14) << "un_cerrojo" << setw(14) << "dos_cerrojos"
+       << setw(14) << "sin_cerrojos" << setw(14) << "pila_cerrojo" << setw(14) << "pila_elimin"
+       << endl
+       << fixed << setprecision(3);
+
+  for (const auto & pc : configuraciones)
+    cout << setw(8) << pc[0] << " x " << pc[1]
+         << setw(14) << mediana<UnCerrojo>(pc[0], pc[1])
+         << setw(14) << mediana<DosCerrojos>(pc[0], pc[1])
+         << setw(14) << mediana<SinCerrojos>(pc[0], pc[1])
+         << setw(14) << mediana<PilaCerrojo>(pc[0], pc[1])
+         << setw(14) << mediana<PilaElimin>(pc[0], pc[1]) << endl;
+}
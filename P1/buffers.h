@@ -0,0 +1,658 @@
+/**
+ * Sistemas concurrentes y distribuidos.
+ * Práctica 1: buffers concurrentes para el problema productor-consumidor
+ *
+ * SemaforoMultiple: semáforo que reserva y libera varias unidades en una sola
+ * operación (para insertar y extraer por lotes).
+ *
+ * ColaDosCerrojos: cola FIFO con un cerrojo para cada extremo, de modo que un
+ * productor y un consumidor pueden trabajar a la vez.
+ *
+ * PilaEliminacion: pila LIFO acotada sin cerrojos (Treiber) con un vector de
+ * eliminación, donde una inserción y una extracción simultáneas se emparejan
+ * sin tocar la cima.
+ *
+ * ColaMPMC: cola FIFO acotada sin cerrojos para varios productores y varios
+ * consumidores (anillo con números de secuencia por celda, según D. Vyukov).
+ * Las operaciones try_* no bloquean nunca; insertar, extraer y sus versiones
+ * por lotes (_n) se bloquean si la cola está llena o vacía. Toda operación
+ * que cambia la cola, try_* incluidas, despierta a quien espere, con un
+ * contador de eventos que solo escribe en memoria compartida (y usa un
+ * cerrojo) cuando de verdad hay alguna hebra dormida.
+ *
+ * Antonio Coín Castro.
+ */
+
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+const size_t tam_linea_cache = 64;   // para separar variables muy usadas
+
+//**********************************************************************
+// Contador de eventos: permite esperar a que cambie una condición que se
+// comprueba sin cerrojos. Quien espera se anota en $esperando$ y toma el valor
+// del contador con preparar(), vuelve a comprobar la condición, y solo si sigue
+// sin cumplirse llama a esperar(); notificar() (llamado después de cambiar la
+// condición) incrementa el contador y despierta a las hebras dormidas, pero
+// solo si hay alguna anotada: si no, no escribe en ninguna variable
+// compartida. Si la notificación llega entre preparar() y esperar(), el
+// contador ya ha cambiado y esperar() vuelve sin dormir.
+//
+// Las barreras seq_cst de preparar() y notificar() ordenan entre sí la
+// anotación de quien espera y el cambio de la condición: o quien notifica ve
+// la anotación, o quien espera ve la condición ya cambiada.
+//----------------------------------------------------------------------
+
+class ContadorEventos
+{
+public:
+  uint64_t preparar()
+  {
+    esperando.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return contador.load(std::memory_order_seq_cst);
+  }
+
+  void cancelar()
+  {
+    esperando.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void esperar(uint64_t clave)
+  {
+    std::unique_lock<std::mutex> lock(cerrojo);
+    cambio.wait(lock, [&] { return contador.load(std::memory_order_seq_cst) != clave; });
+    esperando.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void notificar()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (esperando.load(std::memory_order_relaxed) == 0)
+      return;
+
+    contador.fetch_add(1, std::memory_order_seq_cst);
+    // el cerrojo evita que la notificación se pierda entre la comprobación
+    // del predicado y el bloqueo en esperar()
+    std::unique_lock<std::mutex> lock(cerrojo);
+    cambio.notify_all();
+  }
+
+private:
+  std::atomic<uint64_t>   contador{0};
+  std::atomic<unsigned>   esperando{0};
+  std::mutex              cerrojo;
+  std::condition_variable cambio;
+};
+
+//**********************************************************************
+// Semáforo de varias unidades: esperar_hasta(k) espera a que haya al menos
+// una unidad y toma hasta $k$ de una vez (devuelve cuántas ha tomado), y
+// senalar(k) devuelve $k$ unidades. Una sola operación reserva un lote entero
+// de posiciones del buffer, o las que queden si hay menos.
+//----------------------------------------------------------------------
+
+class SemaforoMultiple
+{
+public:
+  SemaforoMultiple(unsigned valor_inicial) : valor(valor_inicial) { }
+
+  unsigned esperar_hasta(unsigned k)
+  {
+    std::unique_lock<std::mutex> lock(cerrojo);
+    positivo.wait(lock, [this] { return valor > 0; });
+    const unsigned tomadas = valor < k ? valor : k;
+    valor -= tomadas;
+    return tomadas;
+  }
+
+  void senalar(unsigned k)
+  {
+    {
+      std::unique_lock<std::mutex> lock(cerrojo);
+      valor += k;
+    }
+    if (k == 1)
+      positivo.notify_one();
+    else
+      positivo.notify_all();
+  }
+
+private:
+  unsigned                valor;
+  std::mutex              cerrojo;
+  std::condition_variable positivo;
+};
+
+//**********************************************************************
+// Cola FIFO acotada con dos cerrojos: la inserción solo toca la posición de
+// escritura y la extracción solo la de lectura, así que cada una tiene su
+// propio cerrojo, en su propia línea de caché. La cola no espera: quien llama
+// tiene que garantizar que hay hueco al insertar y datos al extraer, como en
+// prodcons-varios.cpp con los semáforos libres y ocupadas (que además ordenan
+// la escritura de una celda antes de su lectura).
+//----------------------------------------------------------------------
+
+template< class T, size_t N >
+class ColaDosCerrojos
+{
+public:
+  void insertar(const T & dato)
+  {
+    std::lock_guard<std::mutex> lock(escritura.cerrojo);
+    datos[escritura.pos] = dato;
+    escritura.pos = (escritura.pos + 1) % N;
+  }
+
+  void extraer(T & dato)
+  {
+    std::lock_guard<std::mutex> lock(lectura.cerrojo);
+    dato = datos[lectura.pos];
+    lectura.pos = (lectura.pos + 1) % N;
+  }
+
+  // $k$ items en una sola sección crítica (ya reservados por quien llama)
+  void insertar_n(const T lote[], unsigned k)
+  {
+    std::lock_guard<std::mutex> lock(escritura.cerrojo);
+    for (unsigned j = 0; j < k; j++)
+      datos[(escritura.pos + j) % N] = lote[j];
+    escritura.pos = (escritura.pos + k) % N;
+  }
+
+  void extraer_n(T lote[], unsigned k)
+  {
+    std::lock_guard<std::mutex> lock(lectura.cerrojo);
+    for (unsigned j = 0; j < k; j++)
+      lote[j] = datos[(lectura.pos + j) % N];
+    lectura.pos = (lectura.pos + k) % N;
+  }
+
+private:
+  struct alignas(tam_linea_cache) Extremo
+  {
+    std::mutex cerrojo;
+    size_t     pos = 0;
+  };
+
+  Extremo escritura, lectura;
+  T       datos[N];
+};
+
+//**********************************************************************
+// Cola MPMC acotada. Cada celda lleva un número de secuencia: la celda de la
+// posición $p$ está libre para el productor de la posición $p$ cuando su
+// secuencia vale $p$, y lista para el consumidor cuando vale $p+1$. Al
+// extraerla, el consumidor la deja en $p+N$ para la siguiente vuelta. Las
+// posiciones de inserción y extracción avanzan con compare_exchange, de modo
+// que productores y consumidores solo compiten entre ellos en una variable
+// atómica cada uno, y no entre sí. Con $N$ potencia de 2 el módulo se queda
+// en una máscara de bits.
+//----------------------------------------------------------------------
+
+template< class T, size_t N >
+class ColaMPMC
+{
+  static_assert(N >= 2, "la cola necesita al menos dos celdas");
+
+public:
+  ColaMPMC()
+  {
+    for (size_t i = 0; i < N; i++)
+      celdas[i].secuencia.store(i, std::memory_order_relaxed);
+  }
+
+  ColaMPMC(const ColaMPMC &) = delete;
+  ColaMPMC & operator=(const ColaMPMC &) = delete;
+
+  // inserta si hay hueco; devuelve false si la cola está llena. Como todas las
+  // operaciones que cambian la cola, despierta a quien espere por ese cambio,
+  // así que se pueden mezclar libremente con las que esperan
+  bool try_insertar(const T & dato)
+  {
+    if (!colocar(dato))
+      return false;
+    hay_dato.notificar();
+    return true;
+  }
+
+  // extrae si hay datos; devuelve false si la cola está vacía
+  bool try_extraer(T & dato)
+  {
+    if (!retirar(dato))
+      return false;
+    hay_hueco.notificar();
+    return true;
+  }
+
+  // inserta, esperando mientras la cola esté llena
+  void insertar(const T & dato)
+  {
+    esperar_colocar(dato);
+    hay_dato.notificar();
+  }
+
+  // extrae, esperando mientras la cola esté vacía
+  void extraer(T & dato)
+  {
+    esperar_retirar(dato);
+    hay_hueco.notificar();
+  }
+
+  // inserta hasta $k\geq 1$ items de $lote$: espera a que haya hueco para el
+  // primero, inserta los siguientes mientras quepan y devuelve cuántos ha
+  // insertado, con una sola notificación para todo el lote
+  unsigned insertar_n(const T lote[], unsigned k)
+  {
+    esperar_colocar(lote[0]);
+    unsigned n = 1;
+    while (n < k && colocar(lote[n]))
+      n++;
+    hay_dato.notificar();
+    return n;
+  }
+
+  // extrae hasta $k\geq 1$ items (al menos uno, esperando si hace falta)
+  unsigned extraer_n(T lote[], unsigned k)
+  {
+    esperar_retirar(lote[0]);
+    unsigned n = 1;
+    while (n < k && retirar(lote[n]))
+      n++;
+    hay_hueco.notificar();
+    return n;
+  }
+
+private:
+  // operaciones sin notificación: las usan las públicas, que notifican una
+  // sola vez al final
+
+  bool colocar(const T & dato)
+  {
+    size_t pos = pos_insercion.valor.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+      Celda &         celda = celdas[pos % N];
+      const size_t    sec   = celda.secuencia.load(std::memory_order_acquire);
+      const ptrdiff_t dif   = ptrdiff_t(sec) - ptrdiff_t(pos);
+
+      if (dif == 0)            // celda libre: intentar reservarla
+      {
+        if (pos_insercion.valor.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          celda.dato = dato;
+          celda.secuencia.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (dif < 0)        // la celda aún no se ha consumido: llena
+        return false;
+      else                     // otro productor la ha reservado: recargar
+        pos = pos_insercion.valor.load(std::memory_order_relaxed);
+    }
+  }
+
+  bool retirar(T & dato)
+  {
+    size_t pos = pos_extraccion.valor.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+      Celda &         celda = celdas[pos % N];
+      const size_t    sec   = celda.secuencia.load(std::memory_order_acquire);
+      const ptrdiff_t dif   = ptrdiff_t(sec) - ptrdiff_t(pos + 1);
+
+      if (dif == 0)            // celda con dato: intentar reservarla
+      {
+        if (pos_extraccion.valor.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          dato = celda.dato;
+          celda.secuencia.store(pos + N, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (dif < 0)        // el dato aún no se ha escrito: vacía
+        return false;
+      else                     // otro consumidor la ha reservado: recargar
+        pos = pos_extraccion.valor.load(std::memory_order_relaxed);
+    }
+  }
+
+  void esperar_colocar(const T & dato)
+  {
+    while (!colocar(dato))
+    {
+      const uint64_t clave = hay_hueco.preparar();
+      if (colocar(dato))
+      {
+        hay_hueco.cancelar();
+        break;
+      }
+      hay_hueco.esperar(clave);
+    }
+  }
+
+  void esperar_retirar(T & dato)
+  {
+    while (!retirar(dato))
+    {
+      const uint64_t clave = hay_dato.preparar();
+      if (retirar(dato))
+      {
+        hay_dato.cancelar();
+        break;
+      }
+      hay_dato.esperar(clave);
+    }
+  }
+
+  struct Celda
+  {
+    std::atomic<size_t> secuencia;
+    T                   dato;
+  };
+
+  // posición en su propia línea de caché, para que productores y
+  // consumidores no se invaliden la línea mutuamente
+  struct Posicion
+  {
+    std::atomic<size_t> valor{0};
+    char                relleno[tam_linea_cache - sizeof(std::atomic<size_t>)];
+  };
+
+  Posicion        pos_insercion, pos_extraccion;
+  Celda           celdas[N];
+
+  // cada contador en sus propias líneas de caché, separado de las celdas
+  alignas(tam_linea_cache) ContadorEventos hay_dato;
+  alignas(tam_linea_cache) ContadorEventos hay_hueco;
+};
+
+//**********************************************************************
+// Pila LIFO acotada sin cerrojos con eliminación.
+//
+// Los $N$ nodos están reservados de antemano: los libres forman una segunda
+// pila, así que insertar en una pila llena falla en lugar de reservar memoria.
+// Las cimas guardan el índice del nodo junto con una etiqueta que cambia en
+// cada modificación, para que un compare_exchange no tenga éxito si entre
+// medias se ha sacado y vuelto a meter el mismo nodo (problema ABA).
+//
+// Cuando el compare_exchange sobre la cima falla por contención, la inserción
+// deja su nodo en una casilla al azar del vector de eliminación y espera un
+// poco: si mientras tanto una extracción (que también ha fallado en la cima)
+// se lo lleva, las dos terminan sin haber tocado la pila. Bajo carga simétrica
+// muchas parejas se resuelven así, y la cima deja de ser el cuello de botella.
+// Las operaciones que bloquean usan contadores de eventos, y las operaciones
+// por lotes y las garantías de notificación son las mismas que en ColaMPMC.
+//----------------------------------------------------------------------
+
+template< class T, size_t N >
+class PilaEliminacion
+{
+  static_assert(N >= 1 && N < 0xFFFFFFFFu, "tamaño de pila no válido");
+
+public:
+  PilaEliminacion()
+  {
+    for (size_t i = 0; i < N; i++)
+      nodos[i].siguiente.store(i + 1 < N ? i + 1 : nulo, std::memory_order_relaxed);
+    cima.store(empaquetar(nulo, 0), std::memory_order_relaxed);
+    libres.store(empaquetar(0, 0), std::memory_order_relaxed);
+    for (size_t i = 0; i < num_casillas; i++)
+      casillas[i].valor.store(0, std::memory_order_relaxed);
+  }
+
+  PilaEliminacion(const PilaEliminacion &) = delete;
+  PilaEliminacion & operator=(const PilaEliminacion &) = delete;
+
+  // inserta si hay hueco; devuelve false si la pila está llena. Igual que en
+  // ColaMPMC, toda operación que cambia la pila (try_* incluidas) despierta a
+  // quien espere por ese cambio
+  bool try_insertar(const T & dato)
+  {
+    if (!colocar(dato))
+      return false;
+    hay_dato.notificar();
+    return true;
+  }
+
+  // extrae si hay datos; devuelve false si la pila está vacía
+  bool try_extraer(T & dato)
+  {
+    if (!retirar(dato))
+      return false;
+    hay_hueco.notificar();
+    return true;
+  }
+
+  // inserta, esperando mientras la pila esté llena
+  void insertar(const T & dato)
+  {
+    esperar_colocar(dato);
+    hay_dato.notificar();
+  }
+
+  // extrae, esperando mientras la pila esté vacía
+  void extraer(T & dato)
+  {
+    esperar_retirar(dato);
+    hay_hueco.notificar();
+  }
+
+  // inserta hasta $k\geq 1$ items (al menos uno, esperando si hace falta) y
+  // devuelve cuántos, con una sola notificación para todo el lote
+  unsigned insertar_n(const T lote[], unsigned k)
+  {
+    esperar_colocar(lote[0]);
+    unsigned n = 1;
+    while (n < k && colocar(lote[n]))
+      n++;
+    hay_dato.notificar();
+    return n;
+  }
+
+  // extrae hasta $k\geq 1$ items (al menos uno, esperando si hace falta)
+  unsigned extraer_n(T lote[], unsigned k)
+  {
+    esperar_retirar(lote[0]);
+    unsigned n = 1;
+    while (n < k && retirar(lote[n]))
+      n++;
+    hay_hueco.notificar();
+    return n;
+  }
+
+private:
+  // operaciones sin notificación: las usan las públicas, que notifican una
+  // sola vez al final
+
+  bool colocar(const T & dato)
+  {
+    const uint32_t nodo = sacar(libres);
+    if (nodo == nulo)
+      return false;
+    nodos[nodo].dato = dato;
+
+    while (!intentar_meter(cima, nodo))
+      if (eliminar_insercion(nodo))
+        break;
+    return true;
+  }
+
+  bool retirar(T & dato)
+  {
+    uint32_t nodo;
+    while (true)
+    {
+      uint64_t c = cima.load(std::memory_order_acquire);
+      nodo = indice(c);
+      if (nodo == nulo)
+      {
+        // pila vacía, pero puede haber una inserción esperando pareja
+        nodo = eliminar_extraccion();
+        if (nodo == nulo)
+          return false;
+        break;
+      }
+      const uint32_t sig = nodos[nodo].siguiente.load(std::memory_order_relaxed);
+      if (cima.compare_exchange_weak(c, empaquetar(sig, etiqueta(c) + 1),
+                                     std::memory_order_acquire, std::memory_order_relaxed))
+        break;
+      nodo = eliminar_extraccion();
+      if (nodo != nulo)
+        break;
+    }
+
+    dato = nodos[nodo].dato;
+    meter(libres, nodo);
+    return true;
+  }
+
+  void esperar_colocar(const T & dato)
+  {
+    while (!colocar(dato))
+    {
+      const uint64_t clave = hay_hueco.preparar();
+      if (colocar(dato))
+      {
+        hay_hueco.cancelar();
+        break;
+      }
+      hay_hueco.esperar(clave);
+    }
+  }
+
+  void esperar_retirar(T & dato)
+  {
+    while (!retirar(dato))
+    {
+      const uint64_t clave = hay_dato.preparar();
+      if (retirar(dato))
+      {
+        hay_dato.cancelar();
+        break;
+      }
+      hay_dato.esperar(clave);
+    }
+  }
+
+  static const uint32_t nulo         = 0xFFFFFFFFu;
+  static const size_t   num_casillas = 8;      // casillas de eliminación
+  static const unsigned espera_max   = 128;    // vueltas esperando pareja
+
+  // estado de una casilla de eliminación (bits 32-33)
+  static const uint64_t vacia = 0, ofrecida = 1, tomada = 2;
+
+  struct Nodo
+  {
+    std::atomic<uint32_t> siguiente;
+    T                     dato;
+  };
+
+  struct alignas(tam_linea_cache) Casilla
+  {
+    // etiqueta (bits 34-63), estado (32-33) y nodo ofrecido (0-31)
+    std::atomic<uint64_t> valor;
+  };
+
+  static uint64_t empaquetar(uint32_t i, uint64_t e) { return (e << 32) | i; }
+  static uint32_t indice(uint64_t c)                 { return uint32_t(c); }
+  static uint64_t etiqueta(uint64_t c)               { return c >> 32; }
+
+  static uint64_t casilla(uint64_t e, uint64_t estado, uint32_t i)
+  {
+    return (e << 34) | (estado << 32) | i;
+  }
+
+  // operaciones de pila de Treiber sobre una cima (la de datos o la de libres)
+  bool intentar_meter(std::atomic<uint64_t> & c, uint32_t nodo)
+  {
+    uint64_t actual = c.load(std::memory_order_relaxed);
+    nodos[nodo].siguiente.store(indice(actual), std::memory_order_relaxed);
+    return c.compare_exchange_strong(actual, empaquetar(nodo, etiqueta(actual) + 1),
+                                     std::memory_order_release, std::memory_order_relaxed);
+  }
+
+  void meter(std::atomic<uint64_t> & c, uint32_t nodo)
+  {
+    while (!intentar_meter(c, nodo))
+      ;
+  }
+
+  uint32_t sacar(std::atomic<uint64_t> & c)
+  {
+    uint64_t actual = c.load(std::memory_order_acquire);
+    while (indice(actual) != nulo)
+    {
+      const uint32_t sig = nodos[indice(actual)].siguiente.load(std::memory_order_relaxed);
+      if (c.compare_exchange_weak(actual, empaquetar(sig, etiqueta(actual) + 1),
+                                  std::memory_order_acquire, std::memory_order_acquire))
+        return indice(actual);
+    }
+    return nulo;
+  }
+
+  static size_t casilla_al_azar()
+  {
+    static thread_local std::minstd_rand generador(std::random_device{}());
+    return generador() % num_casillas;
+  }
+
+  // ofrece el nodo en una casilla; devuelve true si una extracción lo ha tomado
+  bool eliminar_insercion(uint32_t nodo)
+  {
+    Casilla & cas = casillas[casilla_al_azar()];
+    uint64_t  v   = cas.valor.load(std::memory_order_relaxed);
+
+    if (((v >> 32) & 3) != vacia)
+      return false;
+    const uint64_t e = v >> 34, oferta = casilla(e + 1, ofrecida, nodo);
+    if (!cas.valor.compare_exchange_strong(v, oferta, std::memory_order_release,
+                                           std::memory_order_relaxed))
+      return false;
+
+    for (unsigned i = 0; i < espera_max; i++)
+      if (cas.valor.load(std::memory_order_acquire) != oferta)
+        break;
+
+    // retirar la oferta; si ya no está, es que se la han llevado
+    v = oferta;
+    if (cas.valor.compare_exchange_strong(v, casilla(e + 2, vacia, 0),
+                                          std::memory_order_relaxed, std::memory_order_relaxed))
+      return false;
+    cas.valor.store(casilla(e + 3, vacia, 0), std::memory_order_relaxed);   // v: tomada
+    return true;
+  }
+
+  // toma un nodo ofrecido en una casilla al azar (o devuelve nulo)
+  uint32_t eliminar_extraccion()
+  {
+    Casilla & cas = casillas[casilla_al_azar()];
+    uint64_t  v   = cas.valor.load(std::memory_order_acquire);
+
+    if (((v >> 32) & 3) != ofrecida)
+      return nulo;
+    if (!cas.valor.compare_exchange_strong(v, casilla((v >> 34) + 1, tomada, indice(v)),
+                                           std::memory_order_acquire, std::memory_order_relaxed))
+      return nulo;
+    return indice(v);
+  }
+
+  alignas(tam_linea_cache) std::atomic<uint64_t> cima;     // pila de datos
+  alignas(tam_linea_cache) std::atomic<uint64_t> libres;   // pila de nodos libres
+  Casilla         casillas[num_casillas];
+  Nodo            nodos[N];
+
+  alignas(tam_linea_cache) ContadorEventos hay_dato;
+  alignas(tam_linea_cache) ContadorEventos hay_hueco;
+};
+
+#endif
@@ -0,0 +1,137 @@
+/**
+ * Sistemas concurrentes y distribuidos.
+ * Práctica 1: prueba de estrés de los buffers que esperan por sí mismos
+ *
+ * Varios productores y consumidores se pasan items por lotes (insertar_n y
+ * extraer_n) a través de un buffer muy pequeño, de modo que las hebras se
+ * duermen y se despiertan continuamente. Se comprueba que cada item se
+ * consume exactamente una vez y que ninguna hebra se queda dormida para
+ * siempre por una notificación perdida: si una ronda no termina en
+ * $plazo$ segundos, el programa acaba con error.
+ *
+ * Antonio Coín Castro.
+ */
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include "buffers.h"
+
+using namespace std ;
+
+const unsigned num_prods   = 4,
+               num_cons    = 4,
+               tam_lote    = 4,
+               num_items   = 50000,    // items por ronda
+               rondas      = 10,
+               plazo       = 20;       // segundos por ronda
+
+//**********************************************************************
+// una ronda: devuelve false si algún item no se ha consumido una sola vez
+//----------------------------------------------------------------------
+
+template< class Buffer >
+bool ronda(Buffer & buffer)
+{
+  vector< atomic<unsigned> > consumidos(num_items);
+  atomic<unsigned>           pendientes(num_items);   // items sin reservar
+  vector<thread>             hebras;
+
+  for (auto & c : consumidos)
+    c = 0;
+
+  for (unsigned i = 0; i < num_prods; i++)
+    hebras.push_back(thread([&, i]()
+    {
+      const unsigned fin = (i+1)*num_items/num_prods;
+      for (unsigned k = i*num_items/num_prods; k < fin; )
+      {
+        int lote[tam_lote];
+        unsigned n;
+        for (n = 0; n < tam_lote && k + n < fin; n++)
+          lote[n] = k + n;
+        for (unsigned hechos = 0; hechos < n; )
+          hechos += buffer.insertar_n(lote + hechos, n - hechos);
+        k += n;
+      }
+    }));
+
+  for (unsigned i = 0; i < num_cons; i++)
+    hebras.push_back(thread([&]()
+    {
+      while (true)
+      {
+        // reserva hasta un lote de los items que quedan por consumir
+        unsigned quedan = pendientes.load(), k;
+        do
+          k = quedan < tam_lote ? quedan : tam_lote;
+        while (k > 0 && !pendientes.compare_exchange_weak(quedan, quedan - k));
+        if (k == 0)
+          break;
+
+        int lote[tam_lote];
+        for (unsigned hechos = 0; hechos < k; )
+          hechos += buffer.extraer_n(lote + hechos, k - hechos);
+        for (unsigned j = 0; j < k; j++)
+          consumidos[lote[j]]++;
+      }
+    }));
+
+  for (thread & hebra : hebras)
+    hebra.join();
+
+  for (auto & c : consumidos)
+    if (c != 1)
+      return false;
+  return true;
+}
+
+//----------------------------------------------------------------------
+
+template< class Buffer >
+bool probar(const char * nombre)
+{
+  Buffer           buffer;
+  atomic<bool>     terminada(false);
+  bool             ok = true;
+
+  cout << nombre << ": " << flush;
+  for (unsigned r = 0; r < rondas && ok; r++)
+  {
+    terminada = false;
+    thread vigilante([&]()
+    {
+      const auto limite = chrono::steady_clock::now() + chrono::seconds(plazo);
+      while (!terminada && chrono::steady_clock::now() < limite)
+        this_thread::sleep_for(chrono::milliseconds(10));
+      if (!terminada)
+      {
+        cout << "bloqueado en la ronda " << r << endl;
+        _Exit(1);
+      }
+    });
+    ok = ronda(buffer);
+    terminada = true;
+    vigilante.join();
+    cout << "." << flush;
+  }
+  cout << (ok ? " correcto" : " ERROR: algún item no se ha consumido una sola vez") << endl;
+  return ok;
+}
+
+//**********************************************************************
+// Programa principal
+//----------------------------------------------------------------------
+
+int main()
+{
+  bool ok = true;
+  ok &= probar< ColaMPMC<int, 2> >("ColaMPMC<int,2>");
+  ok &= probar< ColaMPMC<int, 10> >("ColaMPMC<int,10>");
+  ok &= probar< PilaEliminacion<int, 2> >("PilaEliminacion<int,2>");
+  ok &= probar< PilaEliminacion<int, 10> >("PilaEliminacion<int,10>");
+  return ok ? 0 : 1;
+}
@@ -12,11 +12,21 @@
 #include <random>
 #include <atomic>
 #include "Semaphore.h"
+#include "buffers.h"
 
 using namespace std ;
 using namespace SEM ;
 
 #define LIFO 0                 // Solución LIFO (1) o FIFO (0)
+#define BUFFER_FIFO 0          // Buffer FIFO (ver buffers.h): con un cerrojo (0),
+                               // sin cerrojos (1) o con un cerrojo por extremo (2)
+#define BUFFER_LIFO 0          // Buffer LIFO: con un cerrojo (0) o pila sin
+                               // cerrojos con eliminación, ver buffers.h (1)
+#define LOTES 0                // Productores y consumidores por lotes (1)
+                               // o de uno en uno (0)
+
+// buffers que esperan por sí mismos cuando están llenos o vacíos (sin semáforos)
+#define BUFFER_CON_ESPERA ((LIFO==0 && BUFFER_FIFO==1) || (LIFO==1 && BUFFER_LIFO==1))
 
 //**********************************************************************
 // variables compartidas
@@ -26,6 +36,7 @@ const int num_items   = 40,            // número de items por cada productor
 	        tam_vec     = 10,             // tamaño del buffer
           num_prods   = 3,
           num_cons    = 2,
+          tam_lote    = 4,              // items por lote (con LOTES==1)
           total_items = num_items * num_prods;
 
 
@@ -35,15 +46,31 @@ unsigned contador_prods = 0,       // controla el número de items producidos
 unsigned  cont_prod[total_items] = {0}, // contadores de verificación: producidos
           cont_cons[total_items] = {0}; // contadores de verificación: consumidos
 
+#if LOTES==1
+SemaforoMultiple ocupadas(0),         // Semáforos de varias unidades: un lote se
+                 libres(tam_vec);     // reserva con una sola operación
+#else
 Semaphore ocupadas = 0,               // Semáforo que controla las posiciones ocupadas
           libres   = tam_vec;         // Semáforo que controla las posiciones libres
+#endif
 
 int vec[tam_vec];                     // Buffer
 
+#if LIFO==0 && BUFFER_FIFO==1
+ColaMPMC<int, tam_vec> buffer;        // Buffer FIFO sin cerrojos (con su propia espera)
+#elif LIFO==0 && BUFFER_FIFO==2
+ColaDosCerrojos<int, tam_vec> buffer; // Buffer FIFO con dos cerrojos (usa los semáforos)
+#elif LIFO==1 && BUFFER_LIFO==1
+PilaEliminacion<int, tam_vec> buffer; // Buffer LIFO sin cerrojos (con su propia espera)
+#endif
+
 mutex mtx, mtx2, mtx3;                            // Candado
 
 #if LIFO==1
 unsigned primera_libre = 0;           // controla buffer LIFO
+#else
+unsigned primera_libre   = 0,         // controla escritura en FIFO
+         primera_ocupada = 0;         // controla lectura en FIFO
 #endif
 
 //**********************************************************************
@@ -65,15 +92,20 @@ template< int min, int max > int aleatorio()
 
 void insertar_dato(int dato)
 {
+#if BUFFER_CON_ESPERA
+  buffer.insertar(dato);              // se bloquea si está lleno
+#elif LIFO==0 && BUFFER_FIFO==2
+  buffer.insertar(dato);              // solo compite con otros productores
+#else
   mtx.lock();
 #if LIFO==1
   vec[primera_libre++] = dato;
 #else
-  static unsigned primera_libre = 0; // controla escritura en FIFO
   vec[primera_libre] = dato;
   primera_libre = (primera_libre+1) % tam_vec;
 #endif
   mtx.unlock();
+#endif
 
   cout << "Insertado: " << dato << endl;
 }
@@ -82,19 +114,85 @@ void insertar_dato(int dato)
 
 void extraer_dato(int & dato)
 {
+#if BUFFER_CON_ESPERA
+  buffer.extraer(dato);               // se bloquea si está vacío
+#elif LIFO==0 && BUFFER_FIFO==2
+  buffer.extraer(dato);               // solo compite con otros consumidores
+#else
   mtx.lock();
 #if LIFO==1
   dato = vec[--primera_libre];
 #else
-  static unsigned primera_ocupada = 0;  // controla lectura en FIFO
   dato = vec[primera_ocupada];
   primera_ocupada = (primera_ocupada+1) % tam_vec;
 #endif
   mtx.unlock();
+#endif
 
   cout << "                  Extraido: " << dato << endl;
 }
 
+//----------------------------------------------------------------------
+// inserción y extracción por lotes: copian hasta $k$ items en una sola sección
+// crítica y devuelven cuántos han copiado (menos de $k$ si el buffer está casi
+// lleno o casi vacío). Quien llama ya ha reservado esas posiciones con los
+// semáforos (o espera el buffer sin cerrojos, que bloquea solo por el primero
+// y notifica una vez por lote a quien espere en el otro extremo).
+
+unsigned insertar_n(const int datos[], unsigned k)
+{
+#if BUFFER_CON_ESPERA
+  const unsigned n = buffer.insertar_n(datos, k);
+#elif LIFO==0 && BUFFER_FIFO==2
+  buffer.insertar_n(datos, k);
+  const unsigned n = k;
+#else
+  mtx.lock();
+#if LIFO==1
+  copy(datos, datos + k, vec + primera_libre);
+  primera_libre += k;
+#else
+  for (unsigned j = 0; j < k; j++)    // a lo sumo dos tramos contiguos
+    vec[(primera_libre + j) % tam_vec] = datos[j];
+  primera_libre = (primera_libre + k) % tam_vec;
+#endif
+  mtx.unlock();
+  const unsigned n = k;
+#endif
+
+  for (unsigned j = 0; j < n; j++)
+    cout << "Insertado: " << datos[j] << endl;
+  return n;
+}
+
+//----------------------------------------------------------------------
+
+unsigned extraer_n(int datos[], unsigned k)
+{
+#if BUFFER_CON_ESPERA
+  const unsigned n = buffer.extraer_n(datos, k);
+#elif LIFO==0 && BUFFER_FIFO==2
+  buffer.extraer_n(datos, k);
+  const unsigned n = k;
+#else
+  mtx.lock();
+#if LIFO==1
+  for (unsigned j = 0; j < k; j++)
+    datos[j] = vec[--primera_libre];
+#else
+  for (unsigned j = 0; j < k; j++)
+    datos[j] = vec[(primera_ocupada + j) % tam_vec];
+  primera_ocupada = (primera_ocupada + k) % tam_vec;
+#endif
+  mtx.unlock();
+  const unsigned n = k;
+#endif
+
+  for (unsigned j = 0; j < n; j++)
+    cout << "                  Extraido: " << datos[j] << endl;
+  return n;
+}
+
 //**********************************************************************
 // funciones comunes a las dos soluciones (FIFO y LIFO)
 //----------------------------------------------------------------------
@@ -161,14 +259,77 @@ bool test_and_inc(bool is_contador_prods)
 
 //----------------------------------------------------------------------
 
+#if LOTES==1
+
+// el productor genera un lote y lo inserta en uno o varios trozos, según el
+// hueco que haya; el consumidor reserva un lote (los items que le quedan por
+// consumir) y lo extrae en uno o varios trozos
+void  funcion_hebra_productora( unsigned i )
+{
+   while (true)
+   {
+      int lote[tam_lote];
+      unsigned k = 0;
+      while (k < tam_lote && ! test_and_inc(true))
+         lote[k++] = producir_dato(i);
+      if (k == 0)
+         break;
+
+      for (unsigned hechos = 0; hechos < k; )
+      {
+#if BUFFER_CON_ESPERA
+         hechos += insertar_n(lote + hechos, k - hechos);
+#else
+         const unsigned n = libres.esperar_hasta(k - hechos);
+         hechos += insertar_n(lote + hechos, n);
+         ocupadas.senalar(n);
+#endif
+      }
+   }
+}
+
+//----------------------------------------------------------------------
+
+void funcion_hebra_consumidora( unsigned i )
+{
+   while (true)
+   {
+      int lote[tam_lote];
+      unsigned k = 0;
+      while (k < tam_lote && ! test_and_inc(false))
+         k++;
+      if (k == 0)
+         break;
+
+      for (unsigned hechos = 0; hechos < k; )
+      {
+#if BUFFER_CON_ESPERA
+         hechos += extraer_n(lote + hechos, k - hechos);
+#else
+         const unsigned n = ocupadas.esperar_hasta(k - hechos);
+         hechos += extraer_n(lote + hechos, n);
+         libres.senalar(n);
+#endif
+      }
+      for (unsigned j = 0; j < k; j++)
+         consumir_dato( lote[j], i ) ;
+   }
+}
+
+#else
+
 void  funcion_hebra_productora( unsigned i )
 {
    while (! test_and_inc(true))
    {
       int dato = producir_dato(i);
+#if BUFFER_CON_ESPERA
+      insertar_dato(dato);            // el buffer ya espera si está lleno
+#else
       sem_wait(libres);
       insertar_dato(dato);
       sem_signal(ocupadas);
+#endif
    }
 }
 
@@ -179,13 +340,19 @@ void funcion_hebra_consumidora( unsigned i )
    while(! test_and_inc(false))
    {
       int dato ;
+#if BUFFER_CON_ESPERA
+      extraer_dato(dato);
+#else
       sem_wait(ocupadas);
       extraer_dato(dato);
       sem_signal(libres);
+#endif
       consumir_dato( dato, i ) ;
     }
 }
 
+#endif
+
 //**********************************************************************
 // Programa principal
 //----------------------------------------------------------------------
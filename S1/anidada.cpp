@@ -0,0 +1,99 @@
+// -----------------------------------------------------------------------------
+// Sistemas Concurrentes y Distribuidos. Seminario 1.
+// Prueba de integrales anidadas: una integral iterada, en la que el integrando
+// de la integral de fuera calcula otra integral con el mismo motor
+// (integral.h). Termina con error si algún resultado es incorrecto, o no
+// termina si las llamadas anidadas se bloquean.
+// Antonio Coín Castro.
+//
+// Compilación:
+//   $ make anidada   (o: g++ -std=c++11 -faligned-new -O3 -march=native -o anidada anidada.cpp -lpthread)
+// -----------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include "integral.h"
+#include "adaptativa.h"
+#include "montecarlo.h"
+#include "cubatura.h"
+
+using namespace std;
+
+const unsigned n        = 4;
+const double   exacto   = 1.0/6.0;   // $\int_0^1\int_0^1 xy^2\,dy\,dx$
+const double   tolerancia = 1e-6;
+
+bool comprobar(const char * nombre, double valor)
+{
+  const bool ok = fabs(valor - exacto) < tolerancia;
+  cout << setw(28) << left << nombre << setprecision(15) << valor
+       << (ok ? "" : "   ERROR") << endl;
+  return ok;
+}
+
+// -----------------------------------------------------------------------------
+// integral iterada con la misma configuración fuera y dentro
+
+double iterada(Particion particion, bool reproducible)
+{
+  Opciones op;
+  op.muestras     = 1000;
+  op.hebras       = n;
+  op.regla        = Regla::simpson;
+  op.particion    = particion;
+  op.reproducible = reproducible;
+
+  return integrar([&](double x)
+  {
+    return integrar([x](double y) { return x*y*y; }, 0.0, 1.0, op);
+  }, 0.0, 1.0, op);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+  bool ok = true;
+
+  ok &= comprobar("contigua",     iterada(Particion::contigua, false));
+  ok &= comprobar("entrelazada",  iterada(Particion::entrelazada, false));
+  ok &= comprobar("dinamica",     iterada(Particion::dinamica, false));
+  ok &= comprobar("reproducible", iterada(Particion::contigua, true));
+
+  // los otros métodos que usan el grupo de hebras, dentro de una integral dinámica
+  Opciones op;
+  op.muestras  = 1000;
+  op.hebras    = n;
+  op.regla     = Regla::simpson;
+  op.particion = Particion::dinamica;
+
+  ok &= comprobar("dinamica + adaptativa", integrar([](double x)
+  {
+    return integrar_adaptativa([x](double y) { return x*y*y; }, 0.0, 1.0, 1e-10, n).valor;
+  }, 0.0, 1.0, op));
+
+  ok &= comprobar("dinamica + producto", integrar([](double x)
+  {
+    return integrar_producto([x](const double * y) { return x*y[0]*y[0]; }, {0.0}, {1.0}, 1000, n);
+  }, 0.0, 1.0, op));
+
+  OpcionesMC mc;
+  mc.muestras = 1 << 12;
+  mc.hebras   = n;
+  mc.muestreo = Muestreo::sobol;
+  const double v = integrar([&](double x)
+  {
+    return integrar_mc([x](const double * y) { return x*y[0]*y[0]; }, {0.0}, {1.0}, mc).valor;
+  }, 0.0, 1.0, op);
+  cout << setw(28) << left << "dinamica + sobol" << setprecision(15) << v
+       << (fabs(v - exacto) < 1e-3 ? "" : "   ERROR") << endl;
+  ok &= fabs(v - exacto) < 1e-3;
+
+  if (!ok)
+  {
+    cout << "!! Hay algún error." << endl;
+    return 1;
+  }
+  cout << "Integrales anidadas correctas." << endl;
+}
@@ -0,0 +1,270 @@
+// -----------------------------------------------------------------------------
+// Sistemas Concurrentes y Distribuidos. Seminario 1.
+// Cubatura concurrente en cajas de dimensión $d$: producto tensorial de la
+// regla del punto medio y rejillas dispersas de Smolyak (Clenshaw-Curtis)
+// Antonio Coín Castro.
+//
+// Uso:
+//   auto f = [](const double * x) { return x[0]*x[1]*x[2]; };
+//   double p = integrar_producto(f, {0,0,0}, {1,1,1}, 64);   // $64^3$ puntos
+//   double s = integrar_smolyak(f, {0,0,0}, {1,1,1}, 5);     // nivel 5
+//
+// $f$ recibe un puntero a las $d$ coordenadas. El espacio de índices se recorre
+// en orden lexicográfico (la última coordenada es la que cambia más deprisa) y
+// se reparte por bloques de filas consecutivas entre las hebras del grupo
+// persistente (ver integral.h): dentro de una fila solo cambia una coordenada.
+// Las sumas de los bloques se combinan en orden, como en el modo reproducible.
+// -----------------------------------------------------------------------------
+
+#ifndef CUBATURA_H
+#define CUBATURA_H
+
+#include <cmath>
+#include <stdexcept>
+#include "integral.h"
+
+const uint64_t puntos_bloque = 4096;   // puntos por bloque de trabajo (aprox.)
+
+// -----------------------------------------------------------------------------
+// regla del punto medio con $m$ puntos por dimensión ($m^d$ en total)
+
+template< class F >
+double integrar_producto(F f, const std::vector<double> & inf,
+                         const std::vector<double> & sup, uint64_t m,
+                         unsigned hebras = std::max(1u, std::thread::hardware_concurrency()))
+{
+  const unsigned d = inf.size();
+  if (d == 0 || sup.size() != d)
+    throw std::invalid_argument("integrar_producto: límites de dimensiones distintas");
+
+  std::vector<double> h(d);
+  double volumen = 1.0;   // volumen de cada celda
+  uint64_t filas = 1;     // combinaciones de las $d-1$ primeras coordenadas
+  for (unsigned j = 0; j < d; j++)
+  {
+    h[j] = (sup[j] - inf[j]) / m;
+    volumen *= h[j];
+    if (j + 1 < d)
+      filas *= m;
+  }
+
+  const uint64_t por_bloque = std::max<uint64_t>(1, puntos_bloque / m),
+                 bloques    = (filas + por_bloque - 1) / por_bloque;
+  std::vector<double> sumas(bloques);
+
+  repartir(grupo_hebras(hebras), bloques, [&](unsigned, uint64_t b)
+  {
+    std::vector<double>   x(d);
+    std::vector<uint64_t> indice(d);
+    const uint64_t        fin = std::min(filas, (b+1) * por_bloque);
+    double                suma = 0.0;
+
+    // índices de la primera fila del bloque (de la última a la primera
+    // coordenada), que después avanzan como un contador
+    uint64_t resto = b * por_bloque;
+    for (unsigned j = d - 1; j-- > 0; )
+    {
+      indice[j] = resto % m;
+      resto    /= m;
+      x[j]      = inf[j] + (indice[j] + 0.5) * h[j];
+    }
+
+    for (uint64_t fila = b * por_bloque; fila < fin; fila++)
+    {
+      for (uint64_t k = 0; k < m; k++)
+      {
+        x[d-1] = inf[d-1] + (k + 0.5) * h[d-1];
+        suma  += f(x.data());
+      }
+
+      for (unsigned j = d - 1; j-- > 0; )   // siguiente fila
+      {
+        if (++indice[j] < m)
+        {
+          x[j] = inf[j] + (indice[j] + 0.5) * h[j];
+          break;
+        }
+        indice[j] = 0;
+        x[j]      = inf[j] + 0.5 * h[j];
+      }
+    }
+    sumas[b] = suma;
+  });
+
+  return volumen * suma_pareada(sumas, 0, bloques);
+}
+
+// -----------------------------------------------------------------------------
+// regla de Clenshaw-Curtis de nivel $i\geq 1$ en $[-1,1]$: 1 punto en el nivel
+// 1 y $2^{i-1}+1$ en los demás (las reglas están anidadas)
+
+struct ReglaCC
+{
+  std::vector<double> nodos, pesos;
+};
+
+inline ReglaCC clenshaw_curtis(unsigned i)
+{
+  ReglaCC r;
+  if (i == 1)
+  {
+    r.nodos.push_back(0.0);
+    r.pesos.push_back(2.0);
+    return r;
+  }
+
+  const unsigned n  = (1u << (i-1));   // subintervalos (número de puntos - 1)
+  const double   pi = 3.14159265358979323846;
+
+  for (unsigned j = 0; j <= n; j++)
+  {
+    double s = 0.0;
+    for (unsigned k = 1; k <= n/2; k++)
+      s += (2*k == n ? 1.0 : 2.0) / (4.0*k*k - 1.0) * std::cos(2.0*pi*k*j / n);
+
+    r.nodos.push_back(-std::cos(pi * j / n));
+    r.pesos.push_back((j == 0 || j == n ? 1.0 : 2.0) / n * (1.0 - s));
+  }
+  return r;
+}
+
+// -----------------------------------------------------------------------------
+// rejilla dispersa de Smolyak de nivel $L$ con la técnica de combinación:
+//
+//   $A(q,d)=\sum_{q-d+1\leq|i|\leq q}(-1)^{q-|i|}\binom{d-1}{q-|i|}\,
+//           U^{i_1}\otimes\cdots\otimes U^{i_d}$,  con $q=d+L$,
+//
+// donde $U^i$ es Clenshaw-Curtis de nivel $i$. Es exacta para polinomios de
+// grado total hasta $2L+1$, con $O(2^L L^{d-1})$ puntos frente a los
+// $O(2^{Ld})$ del producto tensorial completo. Cada rejilla tensorial se suma
+// por separado (los puntos compartidos entre rejillas se evalúan una vez por
+// rejilla), y todas sus filas se reparten juntas entre las hebras.
+
+template< class F >
+double integrar_smolyak(F f, const std::vector<double> & inf,
+                        const std::vector<double> & sup, unsigned nivel,
+                        unsigned hebras = std::max(1u, std::thread::hardware_concurrency()))
+{
+  const unsigned d = inf.size();
+  if (d == 0 || sup.size() != d)
+    throw std::invalid_argument("integrar_smolyak: límites de dimensiones distintas");
+
+  const unsigned q = d + nivel;
+  std::vector<ReglaCC> reglas;              // reglas 1D de los niveles 1..L+1
+  for (unsigned i = 1; i <= nivel + 1; i++)
+    reglas.push_back(clenshaw_curtis(i));
+
+  // rejillas de la combinación: multiíndice, coeficiente y filas
+  struct Rejilla
+  {
+    std::vector<unsigned> nivel;
+    double                coef;
+    uint64_t              filas, primer_bloque, por_bloque;
+  };
+  std::vector<Rejilla> rejillas;
+  uint64_t bloques = 0;
+
+  std::vector<unsigned> i(d, 1);
+  unsigned suma = d;   // $|i|$, siempre $\leq q$
+  while (true)
+  {
+    if (suma + d > q)   // $|i|\geq q-d+1$
+    {
+      const unsigned k = q - suma;
+      double binomial = 1.0;             // $\binom{d-1}{k}$
+      for (unsigned t = 1; t <= k; t++)
+        binomial = binomial * (d - k - 1 + t) / t;
+
+      Rejilla r;
+      r.nivel  = i;
+      r.coef   = (k % 2 ? -1.0 : 1.0) * binomial;
+      r.filas  = 1;
+      for (unsigned j = 0; j + 1 < d; j++)
+        r.filas *= reglas[i[j]-1].nodos.size();
+      r.por_bloque    = std::max<uint64_t>(1, puntos_bloque / reglas[i[d-1]-1].nodos.size());
+      r.primer_bloque = bloques;
+      bloques += (r.filas + r.por_bloque - 1) / r.por_bloque;
+      rejillas.push_back(r);
+    }
+
+    // siguiente multiíndice con $|i|\leq q$: se incrementa la primera
+    // componente que cabe, y las anteriores vuelven a 1
+    unsigned j = 0;
+    for (; j < d; j++)
+    {
+      if (suma < q)
+      {
+        i[j]++;
+        suma++;
+        break;
+      }
+      suma -= i[j] - 1;
+      i[j]  = 1;
+    }
+    if (j == d)
+      break;
+  }
+
+  std::vector<double> escala(d);   // de $[-1,1]$ a $[inf_j,sup_j]$
+  for (unsigned j = 0; j < d; j++)
+    escala[j] = 0.5 * (sup[j] - inf[j]);
+
+  std::vector<double> sumas(bloques);
+
+  repartir(grupo_hebras(hebras), bloques, [&](unsigned, uint64_t b)
+  {
+    // rejilla a la que pertenece el bloque (la última que empieza antes)
+    const Rejilla & r = *(std::upper_bound(rejillas.begin(), rejillas.end(), b,
+                            [](uint64_t c, const Rejilla & x) { return c < x.primer_bloque; }) - 1);
+
+    std::vector<double>   x(d), w(d);   // coordenadas y pesos de las $d-1$ primeras
+    std::vector<uint64_t> indice(d);
+    const ReglaCC &       ultima = reglas[r.nivel[d-1]-1];
+    const uint64_t        ini    = (b - r.primer_bloque) * r.por_bloque,
+                          fin    = std::min(r.filas, ini + r.por_bloque);
+    double                suma   = 0.0;
+
+    uint64_t resto = ini;
+    for (unsigned j = d - 1; j-- > 0; )
+    {
+      const ReglaCC & u = reglas[r.nivel[j]-1];
+      indice[j] = resto % u.nodos.size();
+      resto    /= u.nodos.size();
+    }
+
+    for (uint64_t fila = ini; fila < fin; fila++)
+    {
+      double peso = 1.0;
+      for (unsigned j = 0; j + 1 < d; j++)
+      {
+        const ReglaCC & u = reglas[r.nivel[j]-1];
+        x[j]  = inf[j] + escala[j] * (u.nodos[indice[j]] + 1.0);
+        peso *= u.pesos[indice[j]];
+      }
+
+      double s = 0.0;
+      for (size_t k = 0; k < ultima.nodos.size(); k++)
+      {
+        x[d-1] = inf[d-1] + escala[d-1] * (ultima.nodos[k] + 1.0);
+        s     += ultima.pesos[k] * f(x.data());
+      }
+      suma += peso * s;
+
+      for (unsigned j = d - 1; j-- > 0; )   // siguiente fila
+      {
+        if (++indice[j] < reglas[r.nivel[j]-1].nodos.size())
+          break;
+        indice[j] = 0;
+      }
+    }
+    sumas[b] = r.coef * suma;
+  });
+
+  double jacobiano = 1.0;
+  for (unsigned j = 0; j < d; j++)
+    jacobiano *= escala[j];
+
+  return jacobiano * suma_pareada(sumas, 0, bloques);
+}
+
+#endif
@@ -0,0 +1,150 @@
+// -----------------------------------------------------------------------------
+// Sistemas Concurrentes y Distribuidos. Seminario 1.
+// Banco de pruebas de escalado del motor de integración (integral.h): recorre
+// número de hebras, número de muestras y estrategia de reparto, repite cada
+// medida y escribe en CSV la mediana, su intervalo de confianza del 95 %, la
+// aceleración y la eficiencia respecto a una hebra con la misma estrategia.
+// Incluye una prueba de falsa compartición: las sumas parciales de cada hebra
+// se actualizan en memoria, contiguas o separadas una línea de caché.
+// Antonio Coín Castro.
+//
+// Compilación y ejecución:
+//   $ make escalado   (escribe escalado.csv)
+//   $ ./escalado_exe [repeticiones] [log2(m) máximo] > escalado.csv
+// -----------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include "integral.h"
+
+using namespace std;
+using namespace std::chrono;
+
+const unsigned linea_cache = 64 / sizeof(double);   // doubles por línea de caché
+
+volatile double sumidero;   // evita que se descarten los resultados
+
+// -----------------------------------------------------------------------------
+// evalua la función $f$ a integrar ($f(x)=4/(1+x^2)$)
+inline double f(double x)
+{
+  return 4.0/(1.0+x*x) ;
+}
+
+// -----------------------------------------------------------------------------
+// prueba de falsa compartición: la hebra $i$ acumula sus $m/n$ nodos
+// directamente en sumas[i*separacion] (volátil, así cada suma va a memoria)
+
+void suma_compartida(uint64_t m, unsigned n, unsigned separacion)
+{
+  vector<double> sumas(n * separacion + linea_cache);
+  volatile double * base = sumas.data();
+  vector<thread>  hebras;
+  const double    h = 1.0 / m;
+
+  for (unsigned i = 0; i < n; i++)
+    hebras.push_back(thread([=]()
+    {
+      for (uint64_t k = i*m/n; k < (i+1)*m/n; k++)
+        base[i*separacion] += f((k + 0.5) * h);
+    }));
+  for (thread & hebra : hebras)
+    hebra.join();
+
+  double suma = 0.0;
+  for (unsigned i = 0; i < n; i++)
+    suma += base[i*separacion];
+  sumidero = suma * h;
+}
+
+// -----------------------------------------------------------------------------
+// estrategias medidas
+
+const string estrategias[] = { "contigua", "entrelazada", "dinamica", "reproducible",
+                               "parciales_contiguas", "parciales_separadas" };
+
+void ejecutar(const string & estrategia, uint64_t m, unsigned n)
+{
+  if (estrategia == "parciales_contiguas")
+    return suma_compartida(m, n, 1);
+  if (estrategia == "parciales_separadas")
+    return suma_compartida(m, n, linea_cache);
+
+  Opciones op;
+  op.muestras     = m;
+  op.hebras       = n;
+  op.particion    = estrategia == "contigua"    ? Particion::contigua
+                  : estrategia == "entrelazada" ? Particion::entrelazada
+                                                : Particion::dinamica;
+  op.reproducible = estrategia == "reproducible";
+  sumidero = integrar([](double x) { return f(x); }, 0.0, 1.0, op);
+}
+
+// -----------------------------------------------------------------------------
+// mediana de $r$ medidas ordenadas e intervalo de confianza del 95 % para ella,
+// por estadísticos de orden (aproximación normal de la binomial $B(r,1/2)$)
+
+struct Resumen
+{
+  double mediana, inferior, superior;
+};
+
+Resumen resumir(vector<double> t)
+{
+  sort(t.begin(), t.end());
+  const size_t r = t.size();
+  const double mediana = r % 2 ? t[r/2] : 0.5 * (t[r/2 - 1] + t[r/2]);
+  const double radio   = 1.96 * sqrt(double(r)) / 2.0;
+  const long   j       = max(0L, long(floor(r/2.0 - radio)) - 1),
+               k       = min(long(r) - 1, long(ceil(r/2.0 + radio)));
+  return { mediana, t[j], t[k] };
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+  const unsigned repeticiones = argc > 1 ? atoi(argv[1]) : 7,
+                 log2_maximo  = argc > 2 ? atoi(argv[2]) : 26,
+                 nucleos      = max(1u, thread::hardware_concurrency());
+
+  vector<unsigned> hebras;
+  for (unsigned n = 1; n <= max(4u, 2*nucleos); n *= 2)
+    hebras.push_back(n);
+
+  cout << "estrategia,hebras,muestras,repeticiones,mediana_ms,ic95_inf_ms,ic95_sup_ms,"
+          "aceleracion,eficiencia" << endl << fixed;
+
+  for (const string & estrategia : estrategias)
+    for (unsigned l = 16; l <= log2_maximo; l += 5)
+    {
+      const uint64_t m   = uint64_t(1) << l;
+      double         t_1 = 0.0;   // mediana con una hebra
+
+      for (unsigned n : hebras)
+      {
+        cerr << estrategia << ", n = " << n << ", m = 2^" << l << endl;
+        ejecutar(estrategia, m, n);   // calentamiento (y creación del grupo)
+
+        vector<double> tiempos;
+        for (unsigned r = 0; r < repeticiones; r++)
+        {
+          const time_point<steady_clock> inicio = steady_clock::now();
+          ejecutar(estrategia, m, n);
+          tiempos.push_back(duration<double,milli>(steady_clock::now() - inicio).count());
+        }
+
+        const Resumen res = resumir(tiempos);
+        if (n == 1)
+          t_1 = res.mediana;
+
+        cout << estrategia << ',' << n << ',' << m << ',' << repeticiones << ','
+             << setprecision(4) << res.mediana << ',' << res.inferior << ',' << res.superior << ','
+             << setprecision(3) << t_1 / res.mediana << ',' << t_1 / res.mediana / n << endl;
+      }
+    }
+}
@@ -0,0 +1,517 @@
+// -----------------------------------------------------------------------------
+// Sistemas Concurrentes y Distribuidos. Seminario 1.
+// Motor genérico para el cálculo concurrente de integrales definidas
+// Antonio Coín Castro.
+//
+// Uso:
+//   Opciones op;                       // valores por defecto (ver abajo)
+//   op.regla = Regla::simpson;
+//   double r = integrar([](double x) { return x*x; }, 0.0, 1.0, op);
+//
+// El integrando es cualquier objeto invocable con un double. Al ser un
+// parámetro de plantilla, el compilador puede expandirlo en línea dentro del
+// bucle de cada hebra.
+// -----------------------------------------------------------------------------
+
+#ifndef INTEGRAL_H
+#define INTEGRAL_H
+
+#include <future>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include "topologia.h"
+
+// regla de cuadratura sobre $m$ subintervalos de anchura $h=(b-a)/m$
+enum class Regla
+{
+  punto_medio,   // $m$ nodos, en el centro de cada subintervalo
+  trapecio,      // $m+1$ nodos, en los extremos de cada subintervalo
+  simpson        // $m+1$ nodos ($m$ par), pesos $1,4,2,4,\dots,2,4,1$ (por $h/3$)
+};
+
+// reparto de los nodos entre las hebras
+enum class Particion
+{
+  contigua,      // la hebra $i$ evalúa un bloque de nodos consecutivos
+  entrelazada,   // la hebra $i$ evalúa los bloques $i$, $i+n$, $i+2n$, ...
+  dinamica       // trozos repartidos en tiempo de ejecución entre las hebras
+                 // de un grupo persistente, que se roban trabajo (ver Grupo)
+};
+
+// nodos consecutivos por bloque en la partición entrelazada y en el modo
+// reproducible (múltiplo de los carriles, para que cada bloque se pueda
+// vectorizar entero)
+const uint64_t bloque = 4096;
+
+struct Opciones
+{
+  uint64_t  muestras;    // número de subintervalos ($m$)
+  unsigned  hebras;      // número de hebras ($n$)
+  Regla     regla;
+  Particion particion;
+  bool      reproducible;   // resultado idéntico bit a bit para cualquier $n$
+                            // y cualquier partición (ver suma_reproducible)
+  bool      compensada;     // suma compensada de Kahan en cada carril
+  bool      fijar;          // fija cada hebra a una CPU y anota en cuál ha
+                            // ejecutado sus tareas (ver topologia.h)
+
+  Opciones()
+    : muestras(uint64_t(1) << 30),
+      hebras(std::max(1u, std::thread::hardware_concurrency())),
+      regla(Regla::punto_medio),
+      particion(Particion::contigua),
+      reproducible(false),
+      compensada(false),
+      fijar(false) { }
+};
+
+// -----------------------------------------------------------------------------
+// nodos de la regla: número, y desplazamiento de la abscisa del primero
+// (relativo a $h$)
+
+inline uint64_t num_nodos(Regla regla, uint64_t m)
+{
+  return regla == Regla::punto_medio ? m : m + 1;
+}
+
+inline double desplazamiento(Regla regla)
+{
+  return regla == Regla::punto_medio ? 0.5 : 0.0;
+}
+
+// -----------------------------------------------------------------------------
+// suma de $f$ en los nodos $k$ con $ini\leq k<fin$, separando los de índice par
+// y los de índice impar. Se usan $carriles$ acumuladores independientes sobre
+// nodos consecutivos: así las sumas no forman una única cadena de dependencias
+// y el compilador puede evaluar $f$ en varios nodos a la vez con instrucciones
+// vectoriales (con -O3 -march=native). Con $compensada$, cada carril lleva
+// además el término de corrección de Kahan (no compilar con -ffast-math, que
+// lo elimina).
+
+const unsigned carriles = 8;   // acumuladores por hebra (par)
+
+template< bool compensada, class F >
+void suma_carriles(const F & f, double a, double h, double d, uint64_t ini,
+                   uint64_t fin, double & pares, double & impares)
+{
+  double   acum[carriles] = {}, corr[carriles] = {};
+  uint64_t k = ini;
+
+  for (; k + carriles <= fin; k += carriles)
+    for (unsigned j = 0; j < carriles; j++)
+      if (compensada)
+      {
+        const double y = f(a + (double(k + j) + d) * h) - corr[j],
+                     t = acum[j] + y;
+        corr[j] = (t - acum[j]) - y;
+        acum[j] = t;
+      }
+      else
+        acum[j] += f(a + (double(k + j) + d) * h);
+
+  // el bloque tiene un número par de nodos: la paridad de cada carril es fija
+  for (unsigned j = 0; j < carriles; j++)
+    ((ini + j) % 2 ? impares : pares) += acum[j] - corr[j];
+
+  for (; k < fin; k++)
+    (k % 2 ? impares : pares) += f(a + (double(k) + d) * h);
+}
+
+template< class F >
+void suma_bloque(const F & f, double a, double h, double d, uint64_t ini,
+                 uint64_t fin, bool compensada, double & pares, double & impares)
+{
+  if (compensada)
+    suma_carriles<true>(f, a, h, d, ini, fin, pares, impares);
+  else
+    suma_carriles<false>(f, a, h, d, ini, fin, pares, impares);
+}
+
+// -----------------------------------------------------------------------------
+// suma de $f$ en los nodos de $[ini,fin)$ que corresponden a la hebra $i$
+// ($0\leq i<n$). Los
+// pesos de los extremos se corrigen después, para no comprobarlos en cada nodo:
+// todos pesan 1, salvo en Simpson, donde los nodos pares pesan 2/3 y los
+// impares 4/3.
+
+inline double ponderar(Regla regla, double pares, double impares)
+{
+  if (regla == Regla::simpson)
+    return (2.0*pares + 4.0*impares) / 3.0;
+  return pares + impares;
+}
+
+template< class F >
+double suma_hebra(const F & f, double a, double h, uint64_t ini, uint64_t fin,
+                  const Opciones & op, unsigned i)
+{
+  const uint64_t nodos = fin - ini,
+                 n     = op.hebras;
+  const double   d     = desplazamiento(op.regla);
+  double pares = 0.0, impares = 0.0;
+
+  if (op.particion == Particion::contigua)
+    suma_bloque(f, a, h, d, ini + i*nodos/n, ini + (i+1)*nodos/n, op.compensada,
+                pares, impares);
+  else
+    for (uint64_t k = ini + i*bloque; k < fin; k += n*bloque)
+      suma_bloque(f, a, h, d, k, std::min(k + bloque, fin), op.compensada,
+                  pares, impares);
+
+  return ponderar(op.regla, pares, impares);
+}
+
+// -----------------------------------------------------------------------------
+// indica si la hebra actual está ejecutando ya una tarea concurrente del motor
+// (en un grupo o en una hebra de std::async). Una integral calculada desde el
+// integrando de otra (por ejemplo, una integral iterada) se calcula entonces
+// en la propia hebra: las hebras del grupo pueden estar todas ocupadas con la
+// integral de fuera, esperando a que termine la de dentro.
+
+inline bool & en_tarea()
+{
+  static thread_local bool dentro = false;
+  return dentro;
+}
+
+// -----------------------------------------------------------------------------
+// Grupo persistente de hebras. Las hebras se crean una sola vez y esperan
+// dormidas a que se les encargue una tarea, de forma que cada integral no paga
+// la creación y destrucción de $n$ hebras. La hebra que llama a 'ejecutar'
+// actúa como hebra 0 del grupo. Con $fijar$, la hebra $i$ se ejecuta siempre
+// en la CPU cpu_hebra(i) (la que llama, solo mientras dura la tarea). Una
+// llamada anidada (ver en_tarea) ejecuta tarea(0), ..., tarea(n-1) en orden en
+// la hebra que llama.
+
+class Grupo
+{
+public:
+  explicit Grupo(unsigned n, bool fijar = false) : num(std::max(1u, n)), fijadas(fijar)
+  {
+    for (unsigned i = 1; i < num; i++)
+      hebras.push_back(std::thread(&Grupo::trabajar, this, i));
+  }
+
+  ~Grupo()
+  {
+    {
+      std::unique_lock<std::mutex> lock(cerrojo);
+      fin = true;
+    }
+    hay_tarea.notify_all();
+    for (std::thread & hebra : hebras)
+      hebra.join();
+  }
+
+  unsigned num_hebras() const { return num; }
+
+  // socket de la hebra $i$ (todas en el 0 si no están fijadas)
+  int socket(unsigned i) const { return fijadas ? cpu_hebra(i).socket : 0; }
+
+  // ejecuta tarea(i) en cada hebra $i$ del grupo y espera a que terminen todas
+  void ejecutar(const std::function<void(unsigned)> & t)
+  {
+    if (en_tarea())
+    {
+      for (unsigned i = 0; i < num; i++)
+        t(i);
+      return;
+    }
+
+    std::unique_lock<std::mutex> uso(en_uso);   // una tarea cada vez
+    {
+      std::unique_lock<std::mutex> lock(cerrojo);
+      tarea = &t;
+      pendientes = num - 1;
+      generacion++;
+    }
+    hay_tarea.notify_all();
+
+    {
+      FijacionTemporal fijacion(fijadas ? cpu_hebra(0).id : -1);
+      en_tarea() = true;
+      t(0);
+      en_tarea() = false;
+      if (fijadas)
+        RegistroCpus::global().anotar();
+    }
+
+    std::unique_lock<std::mutex> lock(cerrojo);
+    terminada.wait(lock, [this] { return pendientes == 0; });
+    tarea = nullptr;
+  }
+
+private:
+  void trabajar(unsigned i)
+  {
+    uint64_t vista = 0;   // última generación ejecutada
+
+    en_tarea() = true;
+    if (fijadas)
+      fijar_hebra(cpu_hebra(i).id);
+
+    while (true)
+    {
+      const std::function<void(unsigned)> * t;
+      {
+        std::unique_lock<std::mutex> lock(cerrojo);
+        hay_tarea.wait(lock, [&] { return fin || generacion != vista; });
+        if (fin)
+          return;
+        vista = generacion;
+        t = tarea;
+      }
+
+      (*t)(i);
+      if (fijadas)
+        RegistroCpus::global().anotar();
+
+      std::unique_lock<std::mutex> lock(cerrojo);
+      if (--pendientes == 0)
+        terminada.notify_one();
+    }
+  }
+
+  const unsigned num;
+  const bool     fijadas;
+  std::vector<std::thread> hebras;
+  std::mutex cerrojo, en_uso;
+  std::condition_variable hay_tarea, terminada;
+  const std::function<void(unsigned)> * tarea = nullptr;
+  uint64_t generacion = 0;
+  unsigned pendientes = 0;
+  bool fin = false;
+};
+
+// grupo compartido de $n$ hebras, fijadas o no (se crea en el primer uso y vive
+// hasta el final del programa)
+inline Grupo & grupo_hebras(unsigned n, bool fijar = false)
+{
+  static std::mutex cerrojo;
+  static std::map< std::pair<unsigned,bool>, std::unique_ptr<Grupo> > grupos;
+
+  std::unique_lock<std::mutex> lock(cerrojo);
+  std::unique_ptr<Grupo> & g = grupos[{ n, fijar }];
+  if (!g)
+    g.reset(new Grupo(n, fijar));
+  return *g;
+}
+
+// -----------------------------------------------------------------------------
+// Reparto dinámico con robo de trabajo: los nodos se dividen en trozos y cada
+// hebra recibe un rango contiguo de trozos. Una hebra toma el siguiente trozo
+// de su rango con un fetch_add; cuando lo agota, roba trozos del rango de las
+// demás con la misma operación, así que las hebras rápidas (o las que no han
+// sido desplazadas por el sistema operativo) acaban el trabajo de las lentas.
+//
+// Los datos de cada hebra (Rango, Parcial) van alineados a una línea de caché,
+// para evitar la falsa compartición. En C++11, std::vector solo respeta esa
+// alineación con -faligned-new (ver makefile); sin ella los elementos siguen
+// ocupando una línea cada uno, pero pueden quedar a caballo entre dos.
+
+const size_t tam_linea_cache = 64;
+
+struct alignas(tam_linea_cache) Rango
+{
+  std::atomic<uint64_t> siguiente;   // próximo trozo sin asignar
+  uint64_t              fin;         // uno más que el último trozo del rango
+};
+
+// ejecuta cuerpo(i, c) para cada trozo $c$ ($0\leq c<trozos$), donde $i$ es la
+// hebra del grupo que lo procesa
+template< class C >
+void repartir(Grupo & grupo, uint64_t trozos, const C & cuerpo)
+{
+  const unsigned     n = grupo.num_hebras();
+  std::vector<Rango> rangos(n);
+
+  for (unsigned i = 0; i < n; i++)
+  {
+    rangos[i].siguiente = i*trozos/n;
+    rangos[i].fin       = (i+1)*trozos/n;
+  }
+
+  grupo.ejecutar([&](unsigned i)
+  {
+    // primero el rango propio, luego los de las hebras del mismo socket y por
+    // último los del resto
+    for (unsigned pasada = 0; pasada < 2; pasada++)
+      for (unsigned v = 0; v < n; v++)
+      {
+        const unsigned j = (i + v) % n;
+        if ((grupo.socket(j) == grupo.socket(i)) != (pasada == 0))
+          continue;
+        Rango & r = rangos[j];
+        for (uint64_t c; (c = r.siguiente.fetch_add(1)) < r.fin; )
+          cuerpo(i, c);
+      }
+  });
+}
+
+// sumas parciales de una hebra (una línea de caché por hebra)
+struct alignas(tam_linea_cache) Parcial
+{
+  double pares = 0.0, impares = 0.0;
+};
+
+template< class F >
+double suma_dinamica(const F & f, double a, double h, uint64_t ini, uint64_t fin,
+                     const Opciones & op)
+{
+  const uint64_t nodos = fin - ini;
+  const double   d     = desplazamiento(op.regla);
+  Grupo &        grupo = grupo_hebras(op.hebras, op.fijar);
+  const unsigned n     = grupo.num_hebras();
+
+  // unos 16 trozos por hebra, de al menos 256 nodos y como mucho un bloque
+  const uint64_t trozo = std::min(bloque, std::max<uint64_t>(256, nodos / (16*n)));
+  std::vector<Parcial> parciales(n);
+
+  repartir(grupo, (nodos + trozo - 1) / trozo, [&](unsigned i, uint64_t c)
+  {
+    suma_bloque(f, a, h, d, ini + c*trozo, ini + std::min((c+1)*trozo, nodos),
+                op.compensada, parciales[i].pares, parciales[i].impares);
+  });
+
+  double suma = 0.0;
+  for (unsigned i = 0; i < n; i++)
+    suma += ponderar(op.regla, parciales[i].pares, parciales[i].impares);
+  return suma;
+}
+
+// -----------------------------------------------------------------------------
+// Modo reproducible. El resultado de los otros modos depende de $n$ y de la
+// partición, porque cambian el orden de las sumas en coma flotante. Aquí los
+// nodos se agrupan en bloques de tamaño fijo ($bloque$), cada bloque se suma
+// siempre igual (mismos carriles, mismo orden) y las sumas de los bloques se
+// combinan con un árbol binario fijo (suma por parejas), que solo depende del
+// número de bloques. Qué hebra calcula cada bloque no influye en el resultado.
+// Los bloques están alineados con el principio de la regla, no del rango, así
+// que un reparto entre procesos por múltiplos de $bloque$ produce las mismas
+// sumas de bloque (ver integrar_rango).
+//
+// Entre máquinas distintas el resultado es el mismo siempre que $f$ lo sea y el
+// compilador no contraiga operaciones en FMA de forma distinta (compilar con
+// -ffp-contract=off para comparar entre arquitecturas).
+
+inline double suma_pareada(const std::vector<double> & v, uint64_t ini, uint64_t fin)
+{
+  if (fin - ini == 1)
+    return v[ini];
+  const uint64_t mitad = ini + (fin - ini) / 2;
+  return suma_pareada(v, ini, mitad) + suma_pareada(v, mitad, fin);
+}
+
+template< class F >
+double suma_reproducible(const F & f, double a, double h, uint64_t ini, uint64_t fin,
+                         const Opciones & op)
+{
+  const uint64_t primero = ini / bloque,
+                 trozos  = (fin + bloque - 1) / bloque - primero;
+  const double   d       = desplazamiento(op.regla);
+  std::vector<double> sumas(trozos);
+
+  repartir(grupo_hebras(op.hebras, op.fijar), trozos, [&](unsigned, uint64_t c)
+  {
+    double pares = 0.0, impares = 0.0;
+    suma_bloque(f, a, h, d, std::max(ini, (primero + c)*bloque),
+                std::min((primero + c + 1)*bloque, fin), op.compensada, pares, impares);
+    sumas[c] = ponderar(op.regla, pares, impares);
+  });
+
+  return suma_pareada(sumas, 0, trozos);
+}
+
+// -----------------------------------------------------------------------------
+// subintervalos y nodos de la regla que usan unas opciones (la regla de Simpson
+// necesita un número par de subintervalos)
+
+inline uint64_t subintervalos(const Opciones & op)
+{
+  return op.regla == Regla::simpson ? op.muestras + op.muestras % 2 : op.muestras;
+}
+
+inline uint64_t nodos_regla(const Opciones & op)
+{
+  return num_nodos(op.regla, subintervalos(op));
+}
+
+// -----------------------------------------------------------------------------
+// calcula de forma concurrente la aportación a la integral de $f$ en $[a,b]$ de
+// los nodos $ini\leq k<fin$ de la regla ($0\leq ini\leq fin\leq$
+// nodos_regla(op)). Las aportaciones de rangos disjuntos que cubren todos los
+// nodos suman la integral, así que se pueden calcular en procesos distintos.
+
+template< class F >
+double integrar_rango(F f, double a, double b, const Opciones & op, uint64_t ini,
+                      uint64_t fin)
+{
+  if (ini >= fin)
+    return 0.0;
+
+  Opciones opc = op;
+  opc.hebras = std::max(1u, opc.hebras);
+
+  const double h = (b - a) / subintervalos(opc);
+  double suma = 0.0;
+
+  if (opc.reproducible)
+    suma = suma_reproducible(f, a, h, ini, fin, opc);
+  else if (opc.particion == Particion::dinamica)
+    suma = suma_dinamica(f, a, h, ini, fin, opc);
+  else
+  {
+    std::vector< std::future<double> > futuros;
+
+    // en una llamada anidada, las $n$ partes se calculan en orden en la hebra
+    // que llama (al pedir cada resultado), sin crear hebras ni fijarla
+    const bool anidada = en_tarea();
+
+    for (unsigned i = 0; i < opc.hebras; i++)
+      futuros.push_back(std::async(anidada ? std::launch::deferred : std::launch::async,
+                                   [&, i]()
+      {
+        if (!anidada)
+        {
+          en_tarea() = true;
+          if (opc.fijar)
+            fijar_hebra(cpu_hebra(i).id);
+        }
+        const double s = suma_hebra(f, a, h, ini, fin, opc, i);
+        if (opc.fijar && !anidada)
+          RegistroCpus::global().anotar();
+        return s;
+      }));
+
+    for (unsigned i = 0; i < opc.hebras; i++)
+      suma += futuros[i].get();
+  }
+
+  // pesos de los extremos: 1/2 en el trapecio y 1/3 en Simpson
+  const double extremos = (ini == 0 ? f(a) : 0.0) + (fin == nodos_regla(opc) ? f(b) : 0.0);
+  if (opc.regla == Regla::trapecio)
+    suma -= 0.5 * extremos;
+  else if (opc.regla == Regla::simpson)
+    suma -= extremos / 3.0;
+
+  return suma * h;
+}
+
+// -----------------------------------------------------------------------------
+// calcula de forma concurrente la integral de $f$ en $[a,b]$
+
+template< class F >
+double integrar(F f, double a, double b, const Opciones & op = Opciones())
+{
+  return integrar_rango(f, a, b, op, 0, nodos_regla(op));
+}
+
+#endif
@@ -0,0 +1,61 @@
+// -----------------------------------------------------------------------------
+// Sistemas Concurrentes y Distribuidos. Seminario 1.
+// Latencia por llamada del motor de integración (integral.h) con integrales
+// pequeñas, en las que el coste de arrancar las hebras pesa más que el cálculo.
+// Antonio Coín Castro.
+//
+// Compilación:
+//   $ make latencia   (o: g++ -std=c++11 -faligned-new -O3 -march=native -o latencia latencia.cpp -lpthread)
+// -----------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include "integral.h"
+
+using namespace std;
+using namespace std::chrono;
+
+const unsigned n            = 4;      // hebras por llamada
+const unsigned repeticiones = 2000;   // llamadas por medida
+const uint64_t tamanos[]    = { 1024, 16384, 262144, 4194304 };
+
+// -----------------------------------------------------------------------------
+// tiempo medio (en microsegundos) de una llamada a 'integrar' con $m$ muestras
+
+double latencia(Particion particion, uint64_t m)
+{
+  Opciones op;
+  op.muestras  = m;
+  op.hebras    = n;
+  op.particion = particion;
+
+  // una llamada previa crea el grupo persistente (modo dinámico) y calienta
+  // las cachés
+  volatile double resultado = integrar([](double x) { return 4.0/(1.0+x*x); }, 0.0, 1.0, op);
+
+  const unsigned r = m > 262144 ? repeticiones/100 : repeticiones;
+  time_point<steady_clock> inicio = steady_clock::now();
+  for (unsigned i = 0; i < r; i++)
+    resultado = integrar([](double x) { return 4.0/(1.0+x*x); }, 0.0, 1.0, op);
+  duration<double,micro> tiempo = steady_clock::now() - inicio;
+
+  (void) resultado;
+  return tiempo.count() / r;
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+  cout << "Latencia media por llamada (microsegundos), " << n << " hebras" << endl
+       << setw(10) << "m" << setw(14) << "contigua" << setw(14) << "entrelazada"
+       << setw(14) << "dinámica" << endl
+       << fixed << setprecision(2);
+
+  for (uint64_t m : tamanos)
+    cout << setw(10) << m
+         << setw(14) << latencia(Particion::contigua, m)
+         << setw(14) << latencia(Particion::entrelazada, m)
+         << setw(14) << latencia(Particion::dinamica, m) << endl;
+}
@@ -0,0 +1,278 @@
+// -----------------------------------------------------------------------------
+// Sistemas Concurrentes y Distribuidos. Seminario 1.
+// Integración concurrente de Monte Carlo y cuasi-Monte Carlo (Sobol) en
+// dimensión $d$
+// Antonio Coín Castro.
+//
+// Uso:
+//   OpcionesMC op;                                  // por defecto: Monte Carlo
+//   op.muestreo = Muestreo::sobol;
+//   ResultadoMC r = integrar_mc([](const double * x) { return x[0]*x[1]; },
+//                               {0.0, 0.0}, {1.0, 1.0}, op);
+//   // r.valor, r.error (error típico estimado)
+//
+// Los números aleatorios salen de Philox-4x32-10, un generador basado en un
+// contador: la muestra $k$ es una función pura de ($semilla$, $k$), así que no
+// hay estado compartido entre hebras y el resultado, para una semilla dada, no
+// depende del número de hebras ni del reparto. Los puntos de Sobol usan los
+// números de dirección de Joe y Kuo (hasta $dim_max$ dimensiones), con un
+// desplazamiento digital aleatorio por réplica para poder estimar el error.
+// -----------------------------------------------------------------------------
+
+#ifndef MONTECARLO_H
+#define MONTECARLO_H
+
+#include <cmath>
+#include <stdexcept>
+#include "integral.h"
+
+enum class Muestreo
+{
+  monte_carlo,   // puntos pseudoaleatorios independientes (Philox)
+  sobol          // secuencia de Sobol de baja discrepancia
+};
+
+struct OpcionesMC
+{
+  uint64_t muestras;   // puntos en total
+  unsigned hebras;
+  Muestreo muestreo;
+  uint64_t semilla;
+
+  OpcionesMC()
+    : muestras(uint64_t(1) << 24),
+      hebras(std::max(1u, std::thread::hardware_concurrency())),
+      muestreo(Muestreo::monte_carlo),
+      semilla(2021) { }
+};
+
+struct ResultadoMC
+{
+  double valor;   // integral estimada
+  double error;   // error típico estimado
+};
+
+const unsigned dim_max   = 16;    // dimensiones con números de dirección
+const unsigned replicas  = 8;     // desplazamientos independientes en Sobol
+const unsigned lote      = 8;     // puntos generados a la vez (carriles)
+const uint64_t trozo_mc  = 4096;  // puntos por trozo de trabajo
+
+// -----------------------------------------------------------------------------
+// Philox-4x32-10 (Salmon et al., 2011): diez rondas de multiplicaciones y
+// o-exclusivos sobre el contador, con la clave incrementada en cada ronda
+
+struct Philox
+{
+  uint32_t v[4];
+};
+
+inline Philox philox(Philox c, uint64_t semilla)
+{
+  uint32_t k0 = uint32_t(semilla), k1 = uint32_t(semilla >> 32);
+
+  for (unsigned r = 0; r < 10; r++)
+  {
+    const uint64_t p0 = uint64_t(0xD2511F53u) * c.v[0],
+                   p1 = uint64_t(0xCD9E8D57u) * c.v[2];
+    c = {{ uint32_t(p1 >> 32) ^ c.v[1] ^ k0, uint32_t(p1),
+           uint32_t(p0 >> 32) ^ c.v[3] ^ k1, uint32_t(p0) }};
+    k0 += 0x9E3779B9u;
+    k1 += 0xBB67AE85u;
+  }
+  return c;
+}
+
+// número en $(0,1)$ con 53 bits aleatorios a partir de dos palabras
+inline double uniforme(uint32_t alto, uint32_t bajo)
+{
+  return ((uint64_t(alto) << 21 ^ bajo >> 11) + 0.5) / 9007199254740992.0;   // $2^{53}$
+}
+
+// -----------------------------------------------------------------------------
+// números de dirección de Sobol (Joe y Kuo, new-joe-kuo-6.21201): grado $s$ y
+// coeficientes $a$ del polinomio primitivo, y valores iniciales $m_i$
+
+struct Direccion
+{
+  unsigned s, a, m[6];
+};
+
+const Direccion direcciones[dim_max - 1] =
+{
+  { 1,  0, { 1 } },              { 2,  1, { 1, 3 } },
+  { 3,  1, { 1, 3, 1 } },        { 3,  2, { 1, 1, 1 } },
+  { 4,  1, { 1, 1, 3, 3 } },     { 4,  4, { 1, 3, 5, 13 } },
+  { 5,  2, { 1, 1, 5, 5, 17 } }, { 5,  4, { 1, 1, 5, 5, 5 } },
+  { 5,  7, { 1, 1, 7, 11, 19 } },{ 5, 11, { 1, 1, 5, 1, 1 } },
+  { 5, 13, { 1, 1, 1, 3, 11 } }, { 5, 14, { 1, 3, 5, 5, 31 } },
+  { 6,  1, { 1, 3, 3, 9, 7, 49 } },
+  { 6, 13, { 1, 1, 1, 15, 21, 21 } },
+  { 6, 16, { 1, 3, 1, 13, 27, 49 } }
+};
+
+class Sobol
+{
+public:
+  explicit Sobol(unsigned d) : d(d)
+  {
+    for (unsigned i = 0; i < 32; i++)
+      v[0][i] = 1u << (31 - i);
+
+    for (unsigned j = 1; j < d; j++)
+    {
+      const Direccion & dir = direcciones[j-1];
+      for (unsigned i = 0; i < 32; i++)
+        if (i < dir.s)
+          v[j][i] = dir.m[i] << (31 - i);
+        else
+        {
+          v[j][i] = v[j][i - dir.s] ^ (v[j][i - dir.s] >> dir.s);
+          for (unsigned k = 1; k < dir.s; k++)
+            if ((dir.a >> (dir.s - 1 - k)) & 1)
+              v[j][i] ^= v[j][i - k];
+        }
+    }
+  }
+
+  // coordenadas enteras del punto $k$ (código Gray: $k\oplus(k/2)$)
+  void punto(uint64_t k, uint32_t * x) const
+  {
+    const uint64_t g = k ^ (k >> 1);
+    for (unsigned j = 0; j < d; j++)
+    {
+      x[j] = 0;
+      for (unsigned i = 0; i < 32; i++)
+        if ((g >> i) & 1)
+          x[j] ^= v[j][i];
+    }
+  }
+
+  // pasa del punto $k$ al $k+1$ cambiando solo la dirección del bit que
+  // cambia en el código Gray (el primer cero de $k$)
+  void siguiente(uint64_t k, uint32_t * x) const
+  {
+    unsigned c = 0;
+    while ((k >> c) & 1)
+      c++;
+    for (unsigned j = 0; j < d; j++)
+      x[j] ^= v[j][c];
+  }
+
+private:
+  unsigned d;
+  uint32_t v[dim_max][32];
+};
+
+// -----------------------------------------------------------------------------
+// integral de $f$ en la caja $[inf_j,sup_j]$; $f$ recibe un puntero a las $d$
+// coordenadas del punto
+
+template< class F >
+ResultadoMC integrar_mc(F f, const std::vector<double> & inf,
+                        const std::vector<double> & sup, const OpcionesMC & op = OpcionesMC())
+{
+  const unsigned d = inf.size();
+  if (d == 0 || sup.size() != d)
+    throw std::invalid_argument("integrar_mc: límites de dimensiones distintas");
+  if (op.muestreo == Muestreo::sobol && d > dim_max)
+    throw std::invalid_argument("integrar_mc: Sobol admite como mucho 16 dimensiones");
+
+  double volumen = 1.0;
+  std::vector<double> ancho(d);
+  for (unsigned j = 0; j < d; j++)
+  {
+    ancho[j] = sup[j] - inf[j];
+    volumen *= ancho[j];
+  }
+
+  // en Sobol las muestras se reparten entre las réplicas, cada una con un
+  // desplazamiento digital distinto; en Monte Carlo todas forman una réplica
+  const unsigned r         = op.muestreo == Muestreo::sobol ? replicas : 1;
+  const uint64_t por_rep   = std::max<uint64_t>(1, op.muestras / r),
+                 trozos_rep = (por_rep + trozo_mc - 1) / trozo_mc;
+  const Sobol    sobol(op.muestreo == Muestreo::sobol ? d : 1);
+
+  std::vector<uint32_t> desplaz(r * d);
+  for (unsigned i = 0; i < r; i++)
+    for (unsigned j = 0; j < d; j++)
+      desplaz[i*d + j] = philox({{ i, j, 0x50B01u, 0 }}, op.semilla).v[0];
+
+  // sumas de $f$ y de $f^2$ por trozo: se combinan en orden al final, así el
+  // resultado no depende de qué hebra calcula cada trozo
+  std::vector<double> sumas(r * trozos_rep), cuadrados(r * trozos_rep);
+
+  repartir(grupo_hebras(op.hebras), r * trozos_rep, [&](unsigned, uint64_t c)
+  {
+    const unsigned rep = c / trozos_rep;
+    const uint64_t ini = (c % trozos_rep) * trozo_mc,
+                   fin = std::min(ini + trozo_mc, por_rep);
+    std::vector<double>   x(lote * d);
+    std::vector<uint32_t> s(d);
+    double suma = 0.0, cuadrado = 0.0;
+
+    if (op.muestreo == Muestreo::sobol)
+      sobol.punto(ini, s.data());
+
+    for (uint64_t k = ini; k < fin; k += lote)
+    {
+      const unsigned l = std::min<uint64_t>(lote, fin - k);
+
+      if (op.muestreo == Muestreo::monte_carlo)
+        // dos coordenadas por llamada a Philox; el bucle en $p$ no depende de
+        // iteraciones anteriores y se vectoriza
+        for (unsigned j = 0; j < d; j += 2)
+          for (unsigned p = 0; p < l; p++)
+          {
+            const uint64_t n = k + p;
+            const Philox   a = philox({{ uint32_t(n), uint32_t(n >> 32), j, 0 }}, op.semilla);
+            x[p*d + j] = inf[j] + ancho[j] * uniforme(a.v[0], a.v[1]);
+            if (j + 1 < d)
+              x[p*d + j+1] = inf[j+1] + ancho[j+1] * uniforme(a.v[2], a.v[3]);
+          }
+      else
+        for (unsigned p = 0; p < l; p++)
+        {
+          for (unsigned j = 0; j < d; j++)
+            x[p*d + j] = inf[j] + ancho[j] * ((s[j] ^ desplaz[rep*d + j]) + 0.5) / 4294967296.0;
+          sobol.siguiente(k + p, s.data());
+        }
+
+      for (unsigned p = 0; p < l; p++)
+      {
+        const double y = f(&x[p*d]);
+        suma     += y;
+        cuadrado += y*y;
+      }
+    }
+    sumas[c]     = suma;
+    cuadrados[c] = cuadrado;
+  });
+
+  // media y error típico: en Monte Carlo a partir de la varianza muestral; en
+  // Sobol, de la dispersión de las medias de las réplicas
+  double total = 0.0, total2 = 0.0, medias = 0.0, medias2 = 0.0;
+  for (unsigned i = 0; i < r; i++)
+  {
+    double s = 0.0;
+    for (uint64_t c = i*trozos_rep; c < (i+1)*trozos_rep; c++)
+    {
+      s      += sumas[c];
+      total2 += cuadrados[c];
+    }
+    total   += s;
+    medias  += s / por_rep;
+    medias2 += (s / por_rep) * (s / por_rep);
+  }
+
+  const double n = double(r) * por_rep,
+               media = total / n;
+  double var;
+  if (r == 1)
+    var = std::max(0.0, total2 / n - media*media) / n;
+  else
+    var = std::max(0.0, medias2 / r - (medias / r) * (medias / r)) / (r - 1);
+
+  return { volumen * media, volumen * std::sqrt(var) };
+}
+
+#endif
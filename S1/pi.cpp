@@ -4,7 +4,7 @@
 // Antonio Coín Castro.
 //
 // Compilación:
-//   $ g++ -std=c++11 -o integral integral.cpp -lpthread
+//   $ g++ -std=c++11 -faligned-new -O3 -march=native -o pi pi.cpp -lpthread
 // -----------------------------------------------------------------------------
 
 #include <iostream>
@@ -13,12 +13,17 @@
 #include <future>
 #include <vector>
 #include <cmath>
+#include "integral.h"
+#include "adaptativa.h"
+#include "romberg.h"
+#include "montecarlo.h"
 
 using namespace std;
 using namespace std::chrono;
 
 const long m = 1024l*1024l*1024l;
 const long n = 4;
+const bool fijar = true;   // fija las hebras a CPUs concretas (ver topologia.h)
 
 // -----------------------------------------------------------------------------
 // evalua la función $f$ a integrar ($f(x)=4/(1+x^2)$)
@@ -38,48 +43,17 @@ double calcular_integral_secuencial()
 }
 
 // -----------------------------------------------------------------------------
-// función que ejecuta cada hebra de forma contigua.
-// Recibe $i$ ==índice de la hebra, ($0\leq i<n$)
-// El valor $f(x_i)$ es calculado por la hebra $i/n$
-double funcion_hebra_contigua(long i)
+// calculo de la integral de forma concurrente, con $n$ hebras y la regla del
+// punto medio (ver integral.h)
+double calcular_integral_concurrente(Particion particion)
 {
-  double suma = 0.0;
-  for (int j = (i-1)*(m/n); j < i*(m/n); j++)
-    suma += f((j + double(0.5)) / m);
-  return suma;
-}
+  Opciones op;
+  op.muestras  = m;
+  op.hebras    = n;
+  op.particion = particion;
+  op.fijar     = fijar;
 
-// -----------------------------------------------------------------------------
-// función que ejecuta cada hebra de forma entrelazada.
-// Recibe $i$ ==índice de la hebra, ($0\leq i<n$)
-// El valor f(x_i) es calculado por la hebra $i mod n$
-double funcion_hebra_entrelazada(long i)
-{
-  double suma = 0.0;
-  for (int j = i; j < m; j += n)
-    suma += f((j + double(0.5)) / m);
-  return suma;
-}
-
-// -----------------------------------------------------------------------------
-// calculo de la integral de forma concurrente
-double calcular_integral_concurrente(bool contigua)
-{
-  future<double> futuros[n];
-  double suma = 0;
-  int i;
-
-  if (contigua)
-    for (i = 0; i < n; i++)
-      futuros[i] = async( launch::async, funcion_hebra_contigua, i+1);
-  else
-    for (i = 0; i < n; i++)
-      futuros[i] = async( launch::async, funcion_hebra_entrelazada, i+1);
-
-  for (i = 0; i < n; i++)
-    suma += futuros[i].get();
-
-  return suma/m;
+  return integrar([](double x) { return f(x); }, 0.0, 1.0, op);
 }
 // -----------------------------------------------------------------------------
 
@@ -90,20 +64,59 @@ int main()
   time_point<steady_clock> fin_sec          = steady_clock::now();
   double                   x                = sin(0.4567);
   time_point<steady_clock> inicio_conc_cont = steady_clock::now();
-  double                   result_conc_cont = calcular_integral_concurrente(true);
+  double                   result_conc_cont = calcular_integral_concurrente(Particion::contigua);
   time_point<steady_clock> fin_conc_cont    = steady_clock::now();
   double                   y                = sin(0.6747);
   time_point<steady_clock> inicio_conc_entr = steady_clock::now();
-  double                   result_conc_entr = calcular_integral_concurrente(false);
+  double                   result_conc_entr = calcular_integral_concurrente(Particion::entrelazada);
   time_point<steady_clock> fin_conc_entr    = steady_clock::now();
+  time_point<steady_clock> inicio_conc_din  = steady_clock::now();
+  double                   result_conc_din  = calcular_integral_concurrente(Particion::dinamica);
+  time_point<steady_clock> fin_conc_din     = steady_clock::now();
   duration<float,milli>    tiempo_sec       = fin_sec - inicio_sec;
   duration<float,milli>    tiempo_conc_cont = fin_conc_cont - inicio_conc_cont;
   duration<float,milli>    tiempo_conc_entr = fin_conc_entr - inicio_conc_entr;
+  duration<float,milli>    tiempo_conc_din  = fin_conc_din - inicio_conc_din;
   const float              porc_cont        = 100.0 * tiempo_conc_cont.count() / tiempo_sec.count();
   const float              porc_entr        = 100.0 * tiempo_conc_entr.count() / tiempo_sec.count();
+  const float              porc_din         = 100.0 * tiempo_conc_din.count() / tiempo_sec.count();
 
   constexpr double pi = 3.14159265358979323846l;
 
+  // otras reglas de cuadratura, con muchas menos muestras
+  Opciones op;
+  op.muestras = 1024;
+  op.regla    = Regla::trapecio;
+  const double result_trap = integrar([](double x) { return f(x); }, 0.0, 1.0, op);
+  op.regla    = Regla::simpson;
+  const double result_simp = integrar([](double x) { return f(x); }, 0.0, 1.0, op);
+
+  // reducción reproducible: mismo resultado, bit a bit, con cualquier $n$
+  Opciones rep;
+  rep.muestras     = m;
+  rep.hebras       = n;
+  rep.reproducible = true;
+  const double result_rep = integrar([](double x) { return f(x); }, 0.0, 1.0, rep);
+
+  // Gauss-Kronrod adaptativa, con tolerancia absoluta de $10^{-14}$
+  const Adaptativa result_adap = integrar_adaptativa([](double x) { return f(x); },
+                                                     0.0, 1.0, 1e-14, n);
+
+  // Romberg incremental: cada nivel solo evalúa los puntos medios nuevos
+  Opciones rom;
+  rom.hebras    = n;
+  rom.particion = Particion::dinamica;
+  const ResultadoRomberg result_rom = integrar_romberg([](double x) { return f(x); },
+                                                       0.0, 1.0, 1e-14, rom);
+
+  // Monte Carlo y Sobol: área del cuarto de círculo unidad, en dos dimensiones
+  OpcionesMC mc;
+  mc.hebras = n;
+  auto cuarto_circulo = [](const double * x) { return x[0]*x[0] + x[1]*x[1] <= 1.0 ? 4.0 : 0.0; };
+  const ResultadoMC result_mc  = integrar_mc(cuarto_circulo, {0.0, 0.0}, {1.0, 1.0}, mc);
+  mc.muestreo = Muestreo::sobol;
+  const ResultadoMC result_qmc = integrar_mc(cuarto_circulo, {0.0, 0.0}, {1.0, 1.0}, mc);
+
   cout << "Número de muestras (m)              : " << m << endl
        << "Número de hebras (n)                : " << n << endl
        << setprecision(18)
@@ -111,11 +124,27 @@ int main()
        << "Resultado secuencial                : " << result_sec  << endl
        << "Resultado concurrente (contigua)    : " << result_conc_cont << endl
        << "Resultado concurrente (entrelazada) : " << result_conc_entr << endl
+       << "Resultado concurrente (dinámica)    : " << result_conc_din << endl
+       << "Resultado trapecio (m = 1024)       : " << result_trap << endl
+       << "Resultado Simpson (m = 1024)        : " << result_simp << endl
+       << "Resultado reproducible              : " << result_rep << endl
+       << "Resultado adaptativo (G7-K15)       : " << result_adap.valor
+       << " (" << result_adap.evaluaciones << " evaluaciones)" << endl
+       << "Resultado Romberg                   : " << result_rom.valor
+       << " (" << result_rom.evaluaciones << " evaluaciones)" << endl
+       << "Resultado Monte Carlo (2D)          : " << result_mc.valor
+       << " (error típico " << setprecision(3) << result_mc.error << ")" << endl << setprecision(18)
+       << "Resultado Sobol (2D)                : " << result_qmc.valor
+       << " (error típico " << setprecision(3) << result_qmc.error << ")" << endl << setprecision(18)
        << setprecision(5)
        << "Tiempo secuencial                   : " << tiempo_sec.count()  << " milisegundos. " << endl
        << "Tiempo concurrente (contigua)       : " << tiempo_conc_cont.count() << " milisegundos. " << endl
        << "Tiempo concurrente (entrelazada)    : " << tiempo_conc_entr.count() << " milisegundos. " << endl
+       << "Tiempo concurrente (dinámica)       : " << tiempo_conc_din.count() << " milisegundos. " << endl
        << setprecision(4)
        << "% t.conc/t.sec. (contigua)          : " << porc_cont << "%" << endl
-       << "% t.conc/t.sec. (entrelazada)       : " << porc_entr << "%" << endl;
+       << "% t.conc/t.sec. (entrelazada)       : " << porc_entr << "%" << endl
+       << "% t.conc/t.sec. (dinámica)          : " << porc_din << "%" << endl
+       << "Tareas de hebra por CPU             : " << endl;
+  RegistroCpus::global().informe(cout);
 }
@@ -0,0 +1,87 @@
+// -----------------------------------------------------------------------------
+// Sistemas Concurrentes y Distribuidos. Seminario 1.
+// Cálculo distribuido de la integral con MPI y hebras: los nodos de la regla
+// se reparten entre los procesos, cada proceso reparte los suyos entre sus
+// hebras (integral.h) y las sumas parciales se combinan con MPI_Reduce.
+// Antonio Coín Castro.
+//
+// Compilación y ejecución:
+//   $ make pi_mpi   (o: mpicxx -std=c++11 -faligned-new -O3 -march=native -pthread -o pi_mpi pi_mpi.cpp)
+//   $ mpirun -np 4 ./pi_mpi [log2(m)] [hebras por proceso]
+// -----------------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <mpi.h>
+#include "integral.h"
+
+using namespace std;
+
+const unsigned id_maestro = 0;
+
+// -----------------------------------------------------------------------------
+// evalua la función $f$ a integrar ($f(x)=4/(1+x^2)$)
+double f(double x)
+{
+  return 4.0/(1.0+x*x) ;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char * argv[])
+{
+  int id_propio, num_procesos, nivel;
+
+  // solo la hebra principal de cada proceso llama a MPI
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &nivel);
+  MPI_Comm_rank(MPI_COMM_WORLD, &id_propio);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_procesos);
+
+  // la biblioteca puede ofrecer menos de lo pedido: sin FUNNELED no se pueden
+  // usar hebras junto con MPI
+  if (nivel < MPI_THREAD_FUNNELED)
+  {
+    if (id_propio == id_maestro)
+      cerr << "error: la implementación de MPI no admite MPI_THREAD_FUNNELED" << endl;
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  Opciones op;
+  op.muestras  = uint64_t(1) << (argc > 1 ? atoi(argv[1]) : 32);
+  op.particion = Particion::dinamica;
+  if (argc > 2)
+    op.hebras = atoi(argv[2]);
+
+  // reparto por bloques enteros del motor, para que el modo reproducible
+  // calcule en cada proceso las mismas sumas de bloque que en uno solo
+  const uint64_t nodos   = nodos_regla(op),
+                 bloques = (nodos + bloque - 1) / bloque,
+                 ini     = std::min(nodos, id_propio * bloques / num_procesos * bloque),
+                 fin     = std::min(nodos, (id_propio + 1) * bloques / num_procesos * bloque);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  const double inicio  = MPI_Wtime();
+  const double parcial = integrar_rango([](double x) { return f(x); }, 0.0, 1.0, op, ini, fin);
+  double       total   = 0.0;
+
+  MPI_Reduce(&parcial, &total, 1, MPI_DOUBLE, MPI_SUM, id_maestro, MPI_COMM_WORLD);
+  const double tiempo = MPI_Wtime() - inicio;
+
+  if (id_propio == id_maestro)
+  {
+    constexpr double pi = 3.14159265358979323846l;
+
+    cout << "Número de muestras (m)              : " << op.muestras << endl
+         << "Procesos x hebras                   : " << num_procesos << " x " << op.hebras << endl
+         << setprecision(18)
+         << "Valor de PI                         : " << pi << endl
+         << "Resultado distribuido               : " << total << endl
+         << setprecision(5)
+         << "Tiempo                              : " << tiempo * 1000.0 << " milisegundos. " << endl
+         << "Muestras por segundo                : " << op.muestras / tiempo << endl;
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,104 @@
+// -----------------------------------------------------------------------------
+// Sistemas Concurrentes y Distribuidos. Seminario 1.
+// Método de Romberg incremental sobre el motor de integración (integral.h)
+// Antonio Coín Castro.
+//
+// Uso:
+//   Romberg< decltype(f) > r(f, 0.0, 1.0, op);   // op: hebras, partición, ...
+//   r.refinar();                                 // un nivel más (dobla $m$)
+//   // r.valor(), r.error(), r.evaluaciones()
+//
+//   ResultadoRomberg s = integrar_romberg(f, 0.0, 1.0, 1e-12, op);
+//
+// Al pasar de $m$ a $2m$ subintervalos, los nodos de la regla del trapecio son
+// los anteriores más los puntos medios de los $m$ subintervalos, así que
+// $T_{2m}=(T_m+M_m)/2$, donde $M_m$ es la regla del punto medio: cada nivel
+// solo evalúa los $m$ nodos nuevos (en paralelo, con integrar) y reutiliza la
+// suma anterior. La extrapolación de Richardson sobre la última fila de la
+// tabla elimina los términos $h^2, h^4, \dots$ del error. El trabajo total
+// hasta el nivel $k$ es $2^k+1$ evaluaciones, solo el doble que el último nivel.
+// -----------------------------------------------------------------------------
+
+#ifndef ROMBERG_H
+#define ROMBERG_H
+
+#include <cmath>
+#include "integral.h"
+
+struct ResultadoRomberg
+{
+  double   valor;          // mejor extrapolación
+  double   error;          // diferencia con la extrapolación del nivel anterior
+  uint64_t evaluaciones;   // evaluaciones de $f$
+  unsigned niveles;        // refinamientos realizados
+};
+
+template< class F >
+class Romberg
+{
+public:
+  Romberg(F f, double a, double b, const Opciones & op = Opciones())
+    : f(f), a(a), b(b), op(op), m(1), evals(2), err(INFINITY)
+  {
+    this->op.regla = Regla::punto_medio;
+    fila.push_back(0.5 * (b - a) * (f(a) + f(b)));   // $T_1$
+  }
+
+  // pasa de $m$ a $2m$ subintervalos y añade una fila a la tabla
+  void refinar()
+  {
+    op.muestras = m;
+    const double medio = integrar(f, a, b, op);   // $M_m$: solo nodos nuevos
+
+    std::vector<double> nueva(fila.size() + 1);
+    nueva[0] = 0.5 * (fila[0] + medio);           // $T_{2m}$
+
+    double potencia = 1.0;                        // $4^j$
+    for (size_t j = 1; j < nueva.size(); j++)
+    {
+      potencia *= 4.0;
+      nueva[j] = nueva[j-1] + (nueva[j-1] - fila[j-1]) / (potencia - 1.0);
+    }
+
+    err   = std::fabs(nueva.back() - fila.back());
+    evals += m;
+    m     *= 2;
+    fila.swap(nueva);
+  }
+
+  double   valor()        const { return fila.back(); }
+  double   error()        const { return err; }
+  uint64_t evaluaciones() const { return evals; }
+  uint64_t subintervalos() const { return m; }
+  unsigned niveles()      const { return fila.size() - 1; }
+
+private:
+  F                   f;
+  double              a, b;
+  Opciones            op;
+  uint64_t            m;       // subintervalos del último trapecio
+  uint64_t            evals;
+  double              err;
+  std::vector<double> fila;    // última fila de la tabla de Richardson
+};
+
+// -----------------------------------------------------------------------------
+// refina hasta que el error estimado baje de $tolerancia$ (o se llegue a
+// $max_niveles$)
+
+template< class F >
+ResultadoRomberg integrar_romberg(F f, double a, double b, double tolerancia,
+                                  const Opciones & op = Opciones(),
+                                  unsigned max_niveles = 30)
+{
+  Romberg<F> r(f, a, b, op);
+
+  // con pocos niveles el estimador del error aún no es fiable
+  do
+    r.refinar();
+  while (r.niveles() < max_niveles && (r.niveles() < 3 || r.error() > tolerancia));
+
+  return { r.valor(), r.error(), r.evaluaciones(), r.niveles() };
+}
+
+#endif
@@ -0,0 +1,201 @@
+// -----------------------------------------------------------------------------
+// Sistemas Concurrentes y Distribuidos. Seminario 1.
+// Topología de la máquina (leída de /sys), afinidad de las hebras y registro
+// de los núcleos en los que se ejecutan. Solo funciona en Linux: en otros
+// sistemas no se conoce ninguna CPU, las hebras no se fijan (todas quedan en
+// el socket 0) y el registro no anota nada.
+// Antonio Coín Castro.
+//
+// orden_cpus() da el orden en que se fijan las hebras: primero un hilo
+// hardware de cada núcleo físico, agrupados por socket, y después los hilos
+// hermanos (hyperthreading). Así las hebras $0,1,2,\dots$ llenan un socket antes
+// de pasar al siguiente, y los bloques consecutivos de nodos (y los robos de
+// trabajo entre hebras vecinas) quedan dentro del mismo socket.
+// -----------------------------------------------------------------------------
+
+#ifndef TOPOLOGIA_H
+#define TOPOLOGIA_H
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <algorithm>
+
+struct Cpu
+{
+  int id;       // número de CPU lógica
+  int nucleo;   // núcleo físico dentro del socket
+  int socket;   // paquete físico
+};
+
+// lee un entero de un fichero de /sys (o devuelve $defecto$)
+inline int leer_sys(const std::string & ruta, int defecto)
+{
+  std::ifstream fichero(ruta);
+  int valor;
+  return (fichero >> valor) ? valor : defecto;
+}
+
+// CPUs en las que puede ejecutarse el proceso, con su núcleo y su socket
+inline std::vector<Cpu> cpus_disponibles()
+{
+  std::vector<Cpu> cpus;
+#ifdef __linux__
+  cpu_set_t        mascara;
+
+  if (sched_getaffinity(0, sizeof(mascara), &mascara) != 0)
+    return cpus;
+
+  for (int c = 0; c < CPU_SETSIZE; c++)
+    if (CPU_ISSET(c, &mascara))
+    {
+      const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/";
+      cpus.push_back({ c, leer_sys(dir + "core_id", c),
+                          leer_sys(dir + "physical_package_id", 0) });
+    }
+#endif
+  return cpus;
+}
+
+// orden de asignación de CPUs a hebras (ver arriba); se calcula una vez
+inline const std::vector<Cpu> & orden_cpus()
+{
+  static const std::vector<Cpu> orden = []
+  {
+    std::vector<Cpu> cpus = cpus_disponibles();
+    std::map< std::pair<int,int>, int > vistos;   // hilos ya vistos por núcleo
+    std::vector< std::tuple<int,int,int,int> > claves;   // hilo, socket, núcleo, posición
+
+    for (size_t i = 0; i < cpus.size(); i++)
+      claves.push_back(std::make_tuple(vistos[{ cpus[i].socket, cpus[i].nucleo }]++,
+                                       cpus[i].socket, cpus[i].nucleo, int(i)));
+    std::sort(claves.begin(), claves.end());
+
+    std::vector<Cpu> resultado;
+    for (const auto & c : claves)
+      resultado.push_back(cpus[std::get<3>(c)]);
+    return resultado;
+  }();
+  return orden;
+}
+
+// CPU que corresponde a la hebra $i$ (0 si no se conoce la topología)
+inline Cpu cpu_hebra(unsigned i)
+{
+  const std::vector<Cpu> & orden = orden_cpus();
+  return orden.empty() ? Cpu{ 0, 0, 0 } : orden[i % orden.size()];
+}
+
+// fija la hebra que llama a una CPU; devuelve false si no se ha podido
+inline bool fijar_hebra(int cpu)
+{
+#ifdef __linux__
+  cpu_set_t mascara;
+  CPU_ZERO(&mascara);
+  CPU_SET(cpu, &mascara);
+  return pthread_setaffinity_np(pthread_self(), sizeof(mascara), &mascara) == 0;
+#else
+  (void) cpu;
+  return false;
+#endif
+}
+
+// fija la hebra que la crea a la CPU $cpu$ mientras existe, y al destruirse le
+// devuelve la afinidad que tenía (con $cpu<0$ no hace nada)
+class FijacionTemporal
+{
+public:
+  explicit FijacionTemporal(int cpu) : activa(cpu >= 0)
+  {
+#ifdef __linux__
+    if (activa)
+    {
+      pthread_getaffinity_np(pthread_self(), sizeof(antes), &antes);
+      fijar_hebra(cpu);
+    }
+#endif
+  }
+
+  ~FijacionTemporal()
+  {
+#ifdef __linux__
+    if (activa)
+      pthread_setaffinity_np(pthread_self(), sizeof(antes), &antes);
+#endif
+  }
+
+  FijacionTemporal(const FijacionTemporal &) = delete;
+  FijacionTemporal & operator=(const FijacionTemporal &) = delete;
+
+private:
+  const bool activa;
+#ifdef __linux__
+  cpu_set_t  antes;
+#endif
+};
+
+// -----------------------------------------------------------------------------
+// registro de en qué CPU ha ejecutado cada hebra sus tareas. El motor solo
+// anota las tareas de las hebras fijadas (Opciones::fijar), para no poner un
+// cerrojo global en cada tarea cuando no se pide.
+
+class RegistroCpus
+{
+public:
+  static RegistroCpus & global()
+  {
+    static RegistroCpus registro;
+    return registro;
+  }
+
+  // anota la CPU actual de la hebra que llama
+  void anotar()
+  {
+#ifdef __linux__
+    const int cpu = sched_getcpu();
+    std::unique_lock<std::mutex> lock(cerrojo);
+    cuenta[cpu]++;
+#endif
+  }
+
+  void vaciar()
+  {
+    std::unique_lock<std::mutex> lock(cerrojo);
+    cuenta.clear();
+  }
+
+  // tareas de hebra por CPU (con su núcleo y su socket)
+  void informe(std::ostream & os)
+  {
+    std::map<int, Cpu> topologia;
+    for (const Cpu & c : cpus_disponibles())
+      topologia[c.id] = c;
+
+    std::unique_lock<std::mutex> lock(cerrojo);
+    if (cuenta.empty())
+      os << "  (sin datos: hebras sin fijar o sistema distinto de Linux)" << std::endl;
+    for (const auto & par : cuenta)
+    {
+      const Cpu & c = topologia.count(par.first) ? topologia[par.first] : Cpu{ par.first, -1, -1 };
+      os << "  cpu " << std::setw(3) << c.id << " (socket " << c.socket
+         << ", núcleo " << std::setw(3) << c.nucleo << "): " << par.second << " tareas" << std::endl;
+    }
+  }
+
+private:
+  std::mutex         cerrojo;
+  std::map<int, int> cuenta;
+};
+
+#endif